@@ -0,0 +1,95 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+
+namespace inter {
+
+
+    // Bounded lock-free queue for many producers and one consumer
+    // (D. Vyukov's cell sequence scheme), capacity is rounded up to power of 2
+    template<typename T> class bounded_queue {
+
+        struct cell {
+            std::atomic<std::size_t> sequence;
+            std::optional<T> value;
+        }; // cell
+
+        static constexpr auto cache_line_size = std::size_t{64};
+
+        std::unique_ptr<cell[]> cells_;
+        std::size_t mask_{0u};
+        alignas(cache_line_size) std::atomic<std::size_t> tail_{0u};
+        alignas(cache_line_size) std::atomic<std::size_t> head_{0u};
+
+    public:
+
+        using size_type = std::size_t;
+
+        explicit bounded_queue(size_type capacity)
+            : cells_{std::make_unique<cell[]>(std::bit_ceil(capacity < 2 ? 2 : capacity))},
+              mask_{std::bit_ceil(capacity < 2 ? 2 : capacity) - 1} {
+            for(auto i = size_type{0}; i <= mask_; ++i)
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        bounded_queue(bounded_queue const&) = delete;
+        bounded_queue& operator = (bounded_queue const&) = delete;
+
+
+        size_type capacity() const noexcept {
+            return mask_ + 1;
+        }
+
+
+        // Can be called from any thread, returns false if queue is full
+        template<typename... Args> bool try_push(Args&&... args) {
+            auto position = tail_.load(std::memory_order_relaxed);
+            for(;;) {
+                auto& c = cells_[position & mask_];
+                auto const sequence = c.sequence.load(std::memory_order_acquire);
+                auto const difference = std::ptrdiff_t(sequence) - std::ptrdiff_t(position);
+                if(difference == 0) {
+                    if(tail_.compare_exchange_weak(position, position + 1,
+                                                   std::memory_order_relaxed)) {
+                        c.value.emplace(std::forward<Args>(args)...);
+                        c.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(difference < 0) {
+                    return false;
+                } else {
+                    position = tail_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+
+        // Consumer thread only
+        std::optional<T> try_pop() {
+            auto const position = head_.load(std::memory_order_relaxed);
+            auto& c = cells_[position & mask_];
+            auto const sequence = c.sequence.load(std::memory_order_acquire);
+            if(std::ptrdiff_t(sequence) - std::ptrdiff_t(position + 1) < 0)
+                return std::nullopt;
+            head_.store(position + 1, std::memory_order_relaxed);
+            auto value = std::move(c.value);
+            c.value.reset();
+            c.sequence.store(position + mask_ + 1, std::memory_order_release);
+            return value;
+        }
+
+    }; // bounded_queue
+
+} // namespace inter
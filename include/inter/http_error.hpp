@@ -6,18 +6,22 @@
 # pragma once
 
 
+#include <string>
 #include <system_error>
 
 
 namespace inter {
 
 
+    // Values are status codes of responses reporting the errors
     enum class http_error {
         bad_request = 400,
-        unauthorized,
-        forbidden,
-        not_found,
-        method_not_allowed
+        unauthorized = 401,
+        forbidden = 403,
+        not_found = 404,
+        method_not_allowed = 405,
+        content_too_large = 413,
+        header_fields_too_large = 431
     }; // http_error
 
 
@@ -29,27 +33,31 @@ namespace inter {
         }
 
 
-        virtual string message(int ec) const {
-            switch(error(ec)) {
-                case error::bad_request:
+        virtual std::string message(int ec) const {
+            switch(http_error(ec)) {
+                case http_error::bad_request:
                     return {"Bad request"};
-                case error::unauthorized:
+                case http_error::unauthorized:
                     return {"Unauthorized"};
-                case error::forbidden:
+                case http_error::forbidden:
                     return {"Forbidden"};
-                case error::not_found:
+                case http_error::not_found:
                     return {"Not found"};
-                case error::method_not_allowed:
+                case http_error::method_not_allowed:
                     return {"Method not allowed"};
+                case http_error::content_too_large:
+                    return {"Content too large"};
+                case http_error::header_fields_too_large:
+                    return {"Header fields too large"};
             }
             return {"Unknown"};
         }
     }; // error_category
 
 
-    inline http_error_category const http_error_category;
+    inline http_error_category const http_error_category{};
 
-    inline std::error_code make_error_code(error e) noexcept {
+    inline std::error_code make_error_code(http_error e) noexcept {
         return std::error_code{int(e), http_error_category};
     }
 
@@ -6,9 +6,11 @@
 # pragma once
 
 
+#include <array>
+#include <cstddef>
 #include <optional>
 #include <string_view>
-#include <unordered_map>
+#include <vector>
 
 
 namespace inter {
@@ -64,6 +66,98 @@ namespace inter {
     }
     
 
-    using dynamic_headers = std::unordered_map<std::string_view, std::string_view>;
-    
+    struct dynamic_header {
+        std::string_view name;
+        std::string_view value;
+    }; // dynamic_header
+
+
+    // Headers not known by http_header in order of arrival. The first
+    // InlineCount of them are kept in place, so typical request is parsed
+    // with no allocation; all of them move to the heap past that count
+    template<std::size_t InlineCount>
+    class basic_dynamic_headers {
+        std::array<dynamic_header, InlineCount> inline_{};
+        // Capacity is kept when cleared
+        std::vector<dynamic_header> overflow_;
+        std::size_t size_{0u};
+
+    public:
+
+        using size_type = std::size_t;
+        using value_type = dynamic_header;
+        using const_iterator = dynamic_header const*;
+
+        static constexpr auto inline_count = InlineCount;
+
+
+        size_type size() const noexcept {
+            return size_;
+        }
+
+
+        bool empty() const noexcept {
+            return size_ == 0u;
+        }
+
+
+        dynamic_header const* data() const noexcept {
+            return overflow_.empty() ? inline_.data() : overflow_.data();
+        }
+
+
+        const_iterator begin() const noexcept {
+            return data();
+        }
+
+
+        const_iterator end() const noexcept {
+            return data() + size_;
+        }
+
+
+        // Repeated header is kept as many times as it is received
+        void append(std::string_view name, std::string_view value) {
+            if(size_ < InlineCount && overflow_.empty()) {
+                inline_[size_++] = dynamic_header{name, value};
+                return;
+            }
+            if(overflow_.empty())
+                overflow_.assign(inline_.begin(), inline_.end());
+            overflow_.push_back(dynamic_header{name, value});
+            ++size_;
+        }
+
+
+        void clear() noexcept {
+            overflow_.clear();
+            size_ = 0u;
+        }
+
+
+        // The last of repeated headers is found, end() if there is none
+        const_iterator find(std::string_view name) const noexcept {
+            for(auto it = end(); it != begin(); --it)
+                if(it[-1].name == name)
+                    return it - 1;
+            return end();
+        }
+
+
+        bool contains(std::string_view name) const noexcept {
+            return find(name) != end();
+        }
+
+
+        // Value of header or empty view, like http_request::headers
+        std::string_view value(std::string_view name) const noexcept {
+            auto const it = find(name);
+            return it != end() ? it->value : std::string_view{};
+        }
+
+    }; // basic_dynamic_headers
+
+
+    using dynamic_headers = basic_dynamic_headers<16>;
+
 } // namespace inter
@@ -0,0 +1,218 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin <ortfero@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include <inter/http_error.hpp>
+#include <inter/http_headers.hpp>
+#include <inter/http_request.hpp>
+#include <inter/http_scan.hpp>
+
+
+namespace inter {
+
+
+    enum class http_parse_status {
+        need_more, complete, error
+    }; // http_parse_status
+
+
+    struct http_parse_result {
+        http_parse_status status;
+        // Bytes of request head when it is complete
+        std::size_t consumed{0u};
+        http_error error{http_error::bad_request};
+    }; // http_parse_result
+
+
+    // Parses request head as its bytes arrive. Every call gets all bytes
+    // of the head received so far, they may move between calls but should
+    // not change. Lines parsed already are not scanned again, and the end
+    // of incomplete line is searched from where the previous call stopped
+    class http_parser {
+        // Position of bytes relative to the first byte of the head, since
+        // the head may move between calls
+        struct slice {
+            std::size_t offset{0u};
+            std::size_t size{0u};
+        }; // slice
+
+        struct field_slices {
+            slice name;
+            slice value;
+        }; // field_slices
+
+        std::size_t max_head_size_;
+        // Start of the first line not parsed yet
+        std::size_t line_{0u};
+        // Bytes of the line searched for its end already
+        std::size_t scanned_{0u};
+        bool request_line_parsed_{false};
+        bool request_ready_{false};
+        http_method method_{};
+        slice uri_;
+        int major_version_{0};
+        int minor_version_{0};
+        slice headers_[http_header::count]{};
+        // As many fields as dynamic_headers keeps inline need no memory,
+        // capacity of the rest is kept for the next requests
+        field_slices dynamic_headers_[dynamic_headers::inline_count]{};
+        std::vector<field_slices> overflow_headers_;
+        std::size_t dynamic_count_{0u};
+
+    public:
+
+        using size_type = std::size_t;
+
+        static constexpr auto default_max_head_size = size_type{64 * 1024};
+
+        explicit http_parser(size_type max_head_size = default_max_head_size) noexcept
+            : max_head_size_{max_head_size} {
+        }
+
+
+        // Parses lines of 'input' completed since the previous call. Head
+        // larger than max_head_size is header_fields_too_large error.
+        // Bytes past the end of input are read as by parse_request()
+        http_parse_result parse(std::string_view input, bool padded = false) {
+            // Body may be awaited meanwhile
+            if(request_ready_)
+                return {http_parse_status::complete, line_};
+            auto const bounds = detail::scan_bounds{input.data() + input.size(),
+                                                    padded ? http_request_padding : 0u};
+            for(;;) {
+                auto const* const line = input.data() + line_;
+                auto const* const eol = detail::find_eol(line + scanned_, bounds);
+                if(eol == bounds.end) {
+                    scanned_ = input.size() - line_;
+                    if(input.size() > max_head_size_)
+                        return fail(http_error::header_fields_too_large);
+                    return {http_parse_status::need_more};
+                }
+                if(*eol != '\n')
+                    return fail(http_error::bad_request);
+                auto const line_end = size_type(eol - input.data()) + 1u;
+                if(line_end > max_head_size_)
+                    return fail(http_error::header_fields_too_large);
+                auto const line_bounds = detail::scan_bounds{eol + 1, bounds.padding};
+                if(!parse_line(input, line, line_bounds))
+                    return fail(http_error::bad_request);
+                line_ = line_end;
+                scanned_ = 0u;
+                if(request_ready_)
+                    return {http_parse_status::complete, line_};
+            }
+        }
+
+
+        // Fills 'request' with parts of complete head in 'input', so they
+        // are valid while 'input' stays unchanged. Body is left empty
+        void extract(std::string_view input, http_request& request) const {
+            request.method = method_;
+            request.uri = view_of(input, uri_);
+            request.major_version = major_version_;
+            request.minor_version = minor_version_;
+            for(auto i = 0; i != http_header::count; ++i)
+                request.headers[i] = view_of(input, headers_[i]);
+            request.dynamic_headers.clear();
+            auto const inlined = std::min(dynamic_count_, dynamic_headers::inline_count);
+            for(auto i = size_type{0}; i != inlined; ++i)
+                append_field(input, dynamic_headers_[i], request);
+            for(auto const& field: overflow_headers_)
+                append_field(input, field, request);
+            request.body = {};
+        }
+
+
+        // Prepares parser for the next request
+        void reset() noexcept {
+            line_ = 0u;
+            scanned_ = 0u;
+            request_line_parsed_ = false;
+            request_ready_ = false;
+            for(auto& header: headers_)
+                header = slice{};
+            dynamic_count_ = 0u;
+            overflow_headers_.clear();
+        }
+
+
+        // Prepares parser for the next request and frees memory kept for
+        // the next requests
+        void release() noexcept {
+            reset();
+            overflow_headers_ = std::vector<field_slices>{};
+        }
+
+    private:
+
+        static slice slice_of(std::string_view input, std::string_view part) noexcept {
+            return {size_type(part.data() - input.data()), part.size()};
+        }
+
+
+        static std::string_view view_of(std::string_view input, slice s) noexcept {
+            return input.substr(s.offset, s.size);
+        }
+
+
+        static void append_field(std::string_view input,
+                                 field_slices const& field,
+                                 http_request& request) {
+            request.dynamic_headers.append(view_of(input, field.name),
+                                           view_of(input, field.value));
+        }
+
+
+        bool parse_line(std::string_view input,
+                        char const* text,
+                        detail::scan_bounds const& bounds) {
+            if(!request_line_parsed_) {
+                auto const line = detail::parse_request_line(text, bounds);
+                if(!line || text != bounds.end)
+                    return false;
+                method_ = line->method;
+                uri_ = slice_of(input, line->uri);
+                major_version_ = line->major_version;
+                minor_version_ = line->minor_version;
+                request_line_parsed_ = true;
+                return true;
+            }
+            if(*text == '\r')
+                ++text;
+            if(*text == '\n') {
+                request_ready_ = true;
+                return true;
+            }
+            auto const field = detail::parse_header_field(text, bounds);
+            if(!field || text != bounds.end)
+                return false;
+            auto const slices = field_slices{slice_of(input, field->name),
+                                             slice_of(input, field->value)};
+            if(auto const known = parse_header(field->name); known) {
+                headers_[*known] = slices.value;
+                return true;
+            }
+            if(dynamic_count_ < dynamic_headers::inline_count)
+                dynamic_headers_[dynamic_count_] = slices;
+            else
+                overflow_headers_.push_back(slices);
+            ++dynamic_count_;
+            return true;
+        }
+
+
+        static http_parse_result fail(http_error error) noexcept {
+            return {http_parse_status::error, 0u, error};
+        }
+
+    }; // http_parser
+
+} // namespace inter
@@ -6,11 +6,13 @@
 
 
 #include <charconv>
+#include <cstddef>
 #include <optional>
+#include <span>
 #include <string_view>
-#include <unordered_map>
 
 #include <inter/http_headers.hpp>
+#include <inter/http_scan.hpp>
 
 
 namespace inter {
@@ -86,15 +88,15 @@ namespace inter {
         std::string_view uri;
         int major_version;
         int minor_version;
-        std::string_view headers[http_header::count];
-        dynamic_headers dynamic_headers;
-        std::string_view body;
+        std::string_view headers[http_header::count]{};
+        inter::dynamic_headers dynamic_headers{};
+        std::string_view body{};
     }; // http_request
 
 
     namespace detail {
 
-        char const letters[256] = {
+        constexpr char letters[256] = {
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -113,7 +115,7 @@ namespace inter {
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
         }; // letters
     
-        char const digits[256] = {
+        constexpr char digits[256] = {
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -132,7 +134,7 @@ namespace inter {
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
         }; // digits
 
-        char const uri_characters[256] = {
+        constexpr char uri_characters[256] = {
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
            0, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
@@ -151,7 +153,7 @@ namespace inter {
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
         }; // uri_characters
 
-        char const header_characters[256] = {
+        constexpr char header_characters[256] = {
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0,
@@ -170,107 +172,173 @@ namespace inter {
            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
         }; // header_characters
 
+        constexpr auto method_class = make_char_class(letters);
+        constexpr auto uri_class = make_char_class(uri_characters);
+        constexpr auto header_class = make_char_class(header_characters);
+
     } // namespace detail
 
-    inline std::optional<http_request> parse_request(char const* text) {
-        if(text == nullptr)
-            return std::nullopt;
-        auto const* method_marker = text;
-        while(detail::letters[*text])
-            ++text;
-        auto const method_view = std::string_view{method_marker, text - method_marker};
-        auto const maybe_method = parse_method(method_view);
-        if(!maybe_method)
-            return std::nullopt;
-        auto const method = *maybe_method;
-        if(*text != ' ')
-            return std::nullopt;
-        auto const* uri_marker = ++text;
-        while(detail::uri_characters[*text])
-            ++text;
-        auto const uri = std::string_view{uri_marker, text - uri_marker};
-        if(*text != ' ')
-            return std::nullopt;
-        ++text;
-        if(*text != 'H')
-            return std::nullopt;
-        ++text;
-        if(*text != 'T')
-            return std::nullopt;
-        ++text;
-        if(*text != 'T')
-            return std::nullopt;
-        ++text;
-        if(*text != 'P')
-            return std::nullopt;
-        auto const* major_version_marker = ++text;
-        while(detail::digits[*text])
-            ++text;
-        int major_version;
-        auto const major_version_parsed = std::from_chars(major_version_marker,
-                                                          text,
-                                                          major_version);
-        if(major_version_parsed.ec != std::errc{})
-            return std::nullopt;
-        if(*text != '.')
-            return std::nullopt;
-        auto const* minor_version_marker = ++text;
-        while(detail::digits[*text])
-            ++text;
-        int minor_version;
-        auto const minor_version_parsed = std::from_chars(minor_version_marker,
-                                                          text,
-                                                          minor_version);
-        if(minor_version_parsed.ec != std::errc{})
-            return std::nullopt;
-        if(*text == '\r')
+    // Bytes after the end of padded input the parser may read, so vector
+    // kernels load whole blocks up to the end without bound checks
+    constexpr auto http_request_padding = std::size_t{32};
+
+
+    namespace detail {
+
+        struct request_line {
+            http_method method;
+            std::string_view uri;
+            int major_version;
+            int minor_version;
+        }; // request_line
+
+
+        struct header_field {
+            std::string_view name;
+            std::string_view value;
+        }; // header_field
+
+
+        // Parses request line, 'text' is moved past its end
+        inline std::optional<request_line>
+        parse_request_line(char const*& text, scan_bounds const& bounds) {
+            auto const* const end = bounds.end;
+            auto const next_is = [&](char c) noexcept {
+                return text != end && *text == c;
+            };
+            auto const* method_marker = text;
+            text = skip_class(text, bounds, method_class);
+            auto const method_view = std::string_view{method_marker,
+                                                      std::size_t(text - method_marker)};
+            auto const method = parse_method(method_view);
+            if(!method)
+                return std::nullopt;
+            if(!next_is(' '))
+                return std::nullopt;
+            auto const* uri_marker = ++text;
+            text = skip_class(text, bounds, uri_class);
+            auto const uri = std::string_view{uri_marker, std::size_t(text - uri_marker)};
+            if(!next_is(' '))
+                return std::nullopt;
             ++text;
-        if(*text != '\n')
-            return std::nullopt;
-        ++text;
-        auto request = struct request{
-            .method = method,
-            .uri = uri,
-            .major_version = major_version,
-            .minor_version = minor_version
-        };
-        for(;;) {
-            if(*text == '\r')
+            for(auto const c: std::string_view{"HTTP/"}) {
+                if(!next_is(c))
+                    return std::nullopt;
                 ++text;
-            if(*text == '\n')
-                break;
-            auto const* header_marker = text;
-            while(detail::header_characters[*text])
+            }
+            auto const* major_version_marker = text;
+            while(text != end && digits[static_cast<unsigned char>(*text)])
+                ++text;
+            int major_version;
+            auto const major_version_parsed = std::from_chars(major_version_marker,
+                                                              text,
+                                                              major_version);
+            if(major_version_parsed.ec != std::errc{})
+                return std::nullopt;
+            if(!next_is('.'))
+                return std::nullopt;
+            auto const* minor_version_marker = ++text;
+            while(text != end && digits[static_cast<unsigned char>(*text)])
+                ++text;
+            int minor_version;
+            auto const minor_version_parsed = std::from_chars(minor_version_marker,
+                                                              text,
+                                                              minor_version);
+            if(minor_version_parsed.ec != std::errc{})
+                return std::nullopt;
+            if(next_is('\r'))
                 ++text;
-            auto const header_view = std::string_view{header_marker,
-                                                      text - header_marker};
-            if(*text != ':')
+            if(!next_is('\n'))
+                return std::nullopt;
+            ++text;
+            return request_line{*method, uri, major_version, minor_version};
+        }
+
+
+        // Parses header field line, 'text' is moved past its end
+        inline std::optional<header_field>
+        parse_header_field(char const*& text, scan_bounds const& bounds) {
+            auto const* const end = bounds.end;
+            auto const* header_marker = text;
+            text = skip_class(text, bounds, header_class);
+            auto const name = std::string_view{header_marker, std::size_t(text - header_marker)};
+            if(text == end || *text != ':')
                 return std::nullopt;
             ++text;
-            while(*text == ' ')
+            while(text != end && *text == ' ')
                 ++text;
             auto const* value_marker = text;
-            while(*text != '\0' && *text != '\n')
-                ++text;
+            text = find_eol(text, bounds);
             auto const* eol = text;
-            --text;
-            if(*text == '\r')
+            if(text == end || *text != '\n')
+                return std::nullopt;
+            if(text != value_marker && text[-1] == '\r')
                 --text;
-            while(*text == ' ')
+            while(text != value_marker && text[-1] == ' ')
                 --text;
-            ++text;
-            auto const value = std::string_view{value_marker,
-                                                text - value_marker};
+            auto const value = std::string_view{value_marker, std::size_t(text - value_marker)};
             if(value.empty())
                 return std::nullopt;
-            auto const maybe_header = parse_header(header_view);
-            if(maybe_header) {
-                request.headers[*maybe_header] = value;
-            } else {
-                request.dynamic_headers[header_view] = value;
-            }
+            text = eol + 1;
+            return header_field{name, value};
+        }
+
+
+        inline void store_header(http_request& request, header_field const& field) {
+            if(auto const known = parse_header(field.name); known)
+                request.headers[*known] = field.value;
+            else
+                request.dynamic_headers.append(field.name, field.value);
+        }
+
+    } // namespace detail
+
+
+    // Parses request head, 'input' needs no zero terminator. Vector kernels
+    // never read past its end, the last bytes are scanned one by one.
+    // 'padded' input is followed by at least http_request_padding readable
+    // bytes, e.g. free space of receive buffer, so kernels scan it up to
+    // the end and ignore bytes past it
+    inline std::optional<http_request> parse_request(std::string_view input,
+                                                     bool padded = false) {
+        auto const* text = input.data();
+        auto const* const end = text + input.size();
+        auto const bounds = detail::scan_bounds{end, padded ? http_request_padding : 0u};
+        auto const line = detail::parse_request_line(text, bounds);
+        if(!line)
+            return std::nullopt;
+        auto request = http_request{
+            .method = line->method,
+            .uri = line->uri,
+            .major_version = line->major_version,
+            .minor_version = line->minor_version
+        };
+        for(;;) {
+            if(text != end && *text == '\r')
+                ++text;
+            if(text != end && *text == '\n')
+                break;
+            auto const field = detail::parse_header_field(text, bounds);
+            if(!field)
+                return std::nullopt;
+            detail::store_header(request, *field);
         }
         return request;
-    }   
-    
-} // namespace inter::http
+    }
+
+
+    template<std::size_t Extent>
+    std::optional<http_request> parse_request(std::span<char const, Extent> input,
+                                              bool padded = false) {
+        return parse_request(std::string_view{input.data(), input.size()}, padded);
+    }
+
+
+    // Parses zero terminated request head
+    inline std::optional<http_request> parse_request(char const* text) {
+        if(text == nullptr)
+            return std::nullopt;
+        return parse_request(std::string_view{text});
+    }
+
+} // namespace inter
@@ -0,0 +1,225 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin <ortfero@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define INTER_HTTP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+
+namespace inter::detail {
+
+
+    // Set of characters looked up 16 or 32 at a time with two shuffles:
+    // low nibble of a byte selects mask of high nibbles making the set
+    // with it, high nibble selects its own bit. Characters above 0x7f are
+    // never in the set
+    struct char_class {
+        alignas(16) unsigned char low[16];
+        alignas(16) unsigned char high[16];
+        // Same set for the scalar path
+        char const* table;
+    }; // char_class
+
+
+    constexpr char_class make_char_class(char const (&table)[256]) noexcept {
+        auto result = char_class{{}, {}, table};
+        for(auto c = 0; c != 0x80; ++c)
+            if(table[c] != 0)
+                result.low[c & 0x0f] |= static_cast<unsigned char>(1u << (c >> 4));
+        for(auto h = 0; h != 8; ++h)
+            result.high[h] = static_cast<unsigned char>(1u << h);
+        return result;
+    }
+
+
+    // Input ends at 'end', 'padding' bytes after it are readable too.
+    // Kernels load whole blocks only while they are within padding, the
+    // rest is scanned by scalar loops; bytes past the end are ignored
+    struct scan_bounds {
+        char const* end;
+        std::size_t padding;
+    }; // scan_bounds
+
+
+    template<std::size_t Block>
+    inline bool block_readable(char const* text, scan_bounds const& bounds) noexcept {
+        return text != bounds.end && std::size_t(bounds.end - text) + bounds.padding >= Block;
+    }
+
+
+    inline char const* skip_class_scalar(char const* text,
+                                         scan_bounds const& bounds,
+                                         char_class const& set) noexcept {
+        while(text != bounds.end && set.table[static_cast<unsigned char>(*text)])
+            ++text;
+        return text;
+    }
+
+
+    // End of line, zero or end of input
+    inline char const* find_eol_scalar(char const* text, scan_bounds const& bounds) noexcept {
+        while(text != bounds.end && *text != '\0' && *text != '\n')
+            ++text;
+        return text;
+    }
+
+
+    // Position of the first byte found in a block starting at 'text'
+    inline char const* found_in_block(char const* text,
+                                      unsigned mask,
+                                      std::size_t block,
+                                      scan_bounds const& bounds) noexcept {
+        auto const left = std::size_t(bounds.end - text);
+        if(mask != 0u)
+            return text + std::min(std::size_t(std::countr_zero(mask)), left);
+        return left <= block ? bounds.end : nullptr;
+    }
+
+
+#if defined(INTER_HTTP_SCAN_X86)
+
+    __attribute__((target("sse4.2")))
+    inline char const* skip_class_sse42(char const* text,
+                                        scan_bounds const& bounds,
+                                        char_class const& set) noexcept {
+        auto const low = _mm_load_si128(reinterpret_cast<__m128i const*>(set.low));
+        auto const high = _mm_load_si128(reinterpret_cast<__m128i const*>(set.high));
+        auto const nibble = _mm_set1_epi8(0x0f);
+        while(block_readable<16>(text, bounds)) {
+            auto const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(text));
+            auto const low_bits = _mm_shuffle_epi8(low, _mm_and_si128(bytes, nibble));
+            auto const high_bits = _mm_shuffle_epi8(high,
+                _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+            auto const outside = _mm_cmpeq_epi8(_mm_and_si128(low_bits, high_bits),
+                                                _mm_setzero_si128());
+            auto const mask = unsigned(_mm_movemask_epi8(outside));
+            if(auto const* found = found_in_block(text, mask, 16, bounds); found != nullptr)
+                return found;
+            text += 16;
+        }
+        return skip_class_scalar(text, bounds, set);
+    }
+
+
+    __attribute__((target("sse4.2")))
+    inline char const* find_eol_sse42(char const* text, scan_bounds const& bounds) noexcept {
+        auto const eol = _mm_set1_epi8('\n');
+        while(block_readable<16>(text, bounds)) {
+            auto const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(text));
+            auto const matched = _mm_or_si128(_mm_cmpeq_epi8(bytes, eol),
+                                              _mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+            auto const mask = unsigned(_mm_movemask_epi8(matched));
+            if(auto const* found = found_in_block(text, mask, 16, bounds); found != nullptr)
+                return found;
+            text += 16;
+        }
+        return find_eol_scalar(text, bounds);
+    }
+
+
+    __attribute__((target("avx2")))
+    inline char const* skip_class_avx2(char const* text,
+                                       scan_bounds const& bounds,
+                                       char_class const& set) noexcept {
+        auto const low = _mm256_broadcastsi128_si256(
+            _mm_load_si128(reinterpret_cast<__m128i const*>(set.low)));
+        auto const high = _mm256_broadcastsi128_si256(
+            _mm_load_si128(reinterpret_cast<__m128i const*>(set.high)));
+        auto const nibble = _mm256_set1_epi8(0x0f);
+        while(block_readable<32>(text, bounds)) {
+            auto const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(text));
+            auto const low_bits = _mm256_shuffle_epi8(low, _mm256_and_si256(bytes, nibble));
+            auto const high_bits = _mm256_shuffle_epi8(high,
+                _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+            auto const outside = _mm256_cmpeq_epi8(_mm256_and_si256(low_bits, high_bits),
+                                                   _mm256_setzero_si256());
+            auto const mask = unsigned(_mm256_movemask_epi8(outside));
+            if(auto const* found = found_in_block(text, mask, 32, bounds); found != nullptr)
+                return found;
+            text += 32;
+        }
+        return skip_class_scalar(text, bounds, set);
+    }
+
+
+    __attribute__((target("avx2")))
+    inline char const* find_eol_avx2(char const* text, scan_bounds const& bounds) noexcept {
+        auto const eol = _mm256_set1_epi8('\n');
+        while(block_readable<32>(text, bounds)) {
+            auto const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(text));
+            auto const matched = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, eol),
+                                                 _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()));
+            auto const mask = unsigned(_mm256_movemask_epi8(matched));
+            if(auto const* found = found_in_block(text, mask, 32, bounds); found != nullptr)
+                return found;
+            text += 32;
+        }
+        return find_eol_scalar(text, bounds);
+    }
+
+#endif // INTER_HTTP_SCAN_X86
+
+
+    enum class scan_level {
+        scalar, sse42, avx2
+    }; // scan_level
+
+
+    inline scan_level detect_scan_level() noexcept {
+#if defined(INTER_HTTP_SCAN_X86)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+            return scan_level::avx2;
+        if(__builtin_cpu_supports("sse4.2"))
+            return scan_level::sse42;
+#endif
+        return scan_level::scalar;
+    }
+
+
+    // Chosen once by CPU the process runs on
+    inline scan_level const http_scan_level = detect_scan_level();
+
+
+    // First character of input not in 'set', or its end
+    inline char const* skip_class(char const* text,
+                                  scan_bounds const& bounds,
+                                  char_class const& set) noexcept {
+        switch(http_scan_level) {
+#if defined(INTER_HTTP_SCAN_X86)
+            case scan_level::avx2:
+                return skip_class_avx2(text, bounds, set);
+            case scan_level::sse42:
+                return skip_class_sse42(text, bounds, set);
+#endif
+            default:
+                return skip_class_scalar(text, bounds, set);
+        }
+    }
+
+
+    // First '\n' or zero of input, or its end
+    inline char const* find_eol(char const* text, scan_bounds const& bounds) noexcept {
+        switch(http_scan_level) {
+#if defined(INTER_HTTP_SCAN_X86)
+            case scan_level::avx2:
+                return find_eol_avx2(text, bounds);
+            case scan_level::sse42:
+                return find_eol_sse42(text, bounds);
+#endif
+            default:
+                return find_eol_scalar(text, bounds);
+        }
+    }
+
+} // namespace inter::detail
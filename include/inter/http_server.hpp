@@ -5,48 +5,411 @@
 #pragma once
 
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <cstdint>
 #include <expected>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
 
+#include <inter/http_parser.hpp>
+#include <inter/http_request.hpp>
+#include <inter/http_session.hpp>
+#include <inter/shm_channel.hpp>
+#include <inter/tcp_output.hpp>
 #include <inter/tcp_server.hpp>
 
 
 namespace inter::http {
 
 
-    class http_server : public tcp_server_observer {
+    class http_server_observer {
+    public:
+        virtual ~http_server_observer() = default;
+        // Request and its body are valid during the call only
+        virtual void on_request(int client_socket, http_request const& request) = 0;
+    }; // http_server_observer
+
+
+    struct http_server_options {
+        tcp_server_options tcp{};
+        // Client is answered with 408 if request head or body is not
+        // received in time, idle connection is closed silently
+        std::chrono::milliseconds header_read_timeout{10000};
+        std::chrono::milliseconds body_read_timeout{30000};
+        std::chrono::milliseconds keep_alive_timeout{60000};
+        // Client is answered with 431 if request head is larger
+        std::size_t max_head_size{http_parser::default_max_head_size};
+    }; // http_server_options
+
+
+    class http_server : public tcp_data_observer {
+        http_server_options options_;
         tcp_server tcp_server_;
+        http_server_observer* observer_{nullptr};
+        http_sessions_pool sessions_;
+        // Connection whose request observer is handling now
+        int dispatching_{-1};
+        // Request being dispatched, its memory is reused
+        http_request request_{};
 
     public:
 
-        http_server() = default;
+        using size_type = std::size_t;
+
+        static constexpr auto max_body_size = size_type{16 * 1024 * 1024};
+
+        http_server(): http_server{http_server_options{}} { }
+
+        explicit http_server(tcp_engine engine)
+            : http_server{http_server_options{.tcp = {.engine = engine}}} {
+        }
+
+        explicit http_server(http_server_options const& options)
+            : options_{options}, tcp_server_{options.tcp}, sessions_{options.max_head_size} {
+        }
+
         http_server(http_server const&) = delete;
         http_server& operator = (http_server const&) = delete;
-        http_server(http_server&&) = default;
-        http_server& operator = (http_server&&) = default;
+        http_server(http_server&&) = delete;
+        http_server& operator = (http_server&&) = delete;
 
         void stop() { tcp_server_.stop(); }
 
+        // Stops accepting, answers requests received already with
+        // 'Connection: close' and closes idle connections. Server stops
+        // when all connections are closed or 'timeout' passes
+        void drain(std::chrono::milliseconds timeout) { tcp_server_.drain(timeout); }
+
         std::expected<void, std::error_code>
         listen(std::int16_t port,
+               http_server_observer& observer,
                int connection_requests_limit = tcp_server::default_connection_requests_limit) {
+            observer_ = &observer;
             return tcp_server_.listen(port, *this, connection_requests_limit);
         }
 
+
+        // Serves Unix domain socket, path starting with '@' is abstract
+        std::expected<void, std::error_code>
+        listen_unix(char const* path,
+                    http_server_observer& observer,
+                    int connection_requests_limit = tcp_server::default_connection_requests_limit) {
+            observer_ = &observer;
+            return tcp_server_.listen_unix(path, *this, connection_requests_limit);
+        }
+
+
+        // Serves clients on the same host over shared memory, see
+        // tcp_server::listen_shm(). Epoll engine only
+        std::expected<void, std::error_code>
+        listen_shm(char const* path,
+                   http_server_observer& observer,
+                   size_type ring_capacity = shm_channel::default_capacity,
+                   int connection_requests_limit = tcp_server::default_connection_requests_limit) {
+            observer_ = &observer;
+            return tcp_server_.listen_shm(path, *this, ring_capacity, connection_requests_limit);
+        }
+
+
+        // Serves listening socket received from a predecessor process
+        std::expected<void, std::error_code>
+        listen_inherited(int server_socket, http_server_observer& observer) {
+            observer_ = &observer;
+            return tcp_server_.listen_inherited(server_socket, *this);
+        }
+
+
+        // Sends listening socket to a successor process, reactor thread only
+        std::expected<void, std::error_code> export_listener(int channel) const {
+            return tcp_server_.export_listener(channel);
+        }
+
+
+        // Runs 'task' on the reactor thread as tcp_server::post() does
+        bool post(tcp_task task) {
+            return tcp_server_.post(std::move(task));
+        }
+
+
+        // Sends response with 'body' copied right after the head
+        std::expected<void, std::error_code>
+        send_response(int client_socket,
+                      int status,
+                      std::string_view content_type,
+                      std::span<char const> body) {
+            auto* closing = finish_response(client_socket);
+            auto head = format_head(status, content_type, body.size(),
+                                    closing != nullptr, body.size());
+            head.append(body.data(), body.size());
+            auto sent = tcp_server_.send(client_socket, std::span<char const>{head});
+            close_when_answered(closing);
+            return sent;
+        }
+
+
+        // Sends response head followed by 'body' segments, body is not
+        // copied and goes out with the head in one system call
+        std::expected<void, std::error_code>
+        send_response(int client_socket,
+                      int status,
+                      std::string_view content_type,
+                      tcp_output&& body) {
+            auto* closing = finish_response(client_socket);
+            auto output = tcp_output{};
+            output.append(format_head(status, content_type, body.size(), closing != nullptr));
+            output.append(std::move(body));
+            auto sent = tcp_server_.send(client_socket, std::move(output));
+            close_when_answered(closing);
+            return sent;
+        }
+
     private:
 
-        virtual void on_connected(int, sockaddr_in const&) override {
+        static std::string_view reason_phrase(int status) noexcept {
+            switch(status) {
+                case 200:
+                    return "OK";
+                case 201:
+                    return "Created";
+                case 204:
+                    return "No Content";
+                case 206:
+                    return "Partial Content";
+                case 301:
+                    return "Moved Permanently";
+                case 304:
+                    return "Not Modified";
+                case 400:
+                    return "Bad Request";
+                case 401:
+                    return "Unauthorized";
+                case 403:
+                    return "Forbidden";
+                case 404:
+                    return "Not Found";
+                case 405:
+                    return "Method Not Allowed";
+                case 408:
+                    return "Request Timeout";
+                case 413:
+                    return "Content Too Large";
+                case 431:
+                    return "Request Header Fields Too Large";
+                case 500:
+                    return "Internal Server Error";
+                case 503:
+                    return "Service Unavailable";
+                default:
+                    return "Unknown";
+            }
+        }
+
+
+        static std::string format_head(int status,
+                                       std::string_view content_type,
+                                       size_type content_length,
+                                       bool closing,
+                                       size_type reserved = 0u) {
+            char number[24];
+            auto head = std::string{};
+            head.reserve(128 + content_type.size() + reserved);
+            head += "HTTP/1.1 ";
+            head.append(number, std::to_chars(number, number + sizeof(number), status).ptr);
+            head += ' ';
+            head += reason_phrase(status);
+            head += "\r\n";
+            if(!content_type.empty()) {
+                head += "Content-Type: ";
+                head += content_type;
+                head += "\r\n";
+            }
+            if(closing)
+                head += "Connection: close\r\n";
+            head += "Content-Length: ";
+            head.append(number,
+                        std::to_chars(number, number + sizeof(number), content_length).ptr);
+            head += "\r\n\r\n";
+            return head;
+        }
+
+
+        // Counts response as sent, returns its session if connection
+        // should be closed after it
+        http_session* finish_response(int client_socket) noexcept {
+            auto* connection = tcp_server_.connection(client_socket);
+            if(connection == nullptr || connection->context == nullptr)
+                return nullptr;
+            auto& session = *static_cast<http_session*>(connection->context);
+            if(session.responses_pending != 0u)
+                --session.responses_pending;
+            return session.close_after_response ? &session : nullptr;
+        }
+
+
+        // Response sent from observer's on_request() is closed by
+        // handle_requests(), the one sent later is closed here
+        void close_when_answered(http_session* session) {
+            if(session == nullptr || session->responses_pending != 0u
+               || session->socket == dispatching_)
+                return;
+            tcp_server_.close(session->socket);
+        }
+
+
+        static bool closing_requested(http_request const& request) noexcept {
+            auto const value = request.headers[http_header::connection];
+            return std::ranges::equal(value, std::string_view{"close"},
+                                      [](char a, char b) {
+                return (a | 0x20) == b;
+            });
+        }
+
+
+        // Idle session frees parser memory
+        bool releasing() const noexcept {
+            return options_.tcp.release_idle_buffers;
+        }
+
+
+        http_session& session_of(int client_socket) {
+            auto* connection = tcp_server_.connection(client_socket);
+            if(connection->context == nullptr) {
+                auto session = sessions_.use();
+                session->socket = client_socket;
+                session->address = connection->address;
+                connection->context = session.release();
+            }
+            return *static_cast<http_session*>(connection->context);
+        }
+
+
+        tcp_response reject(int client_socket, int status) {
+            auto const head = format_head(status, {}, 0u, true);
+            (void)tcp_server_.send(client_socket, std::span<char const>{head});
+            return tcp_response::close_connection;
+        }
+
 
+        // Passes every complete request of 'input' to the observer in order,
+        // requests are parsed in place and their bytes consumed at once
+        tcp_consumed handle_requests(http_session& session, std::string_view input) {
+            auto handled = size_type{0};
+            for(;;) {
+                auto const rest = input.substr(handled);
+                auto const parsed = session.parser.parse(rest);
+                switch(parsed.status) {
+                    case http_parse_status::need_more:
+                        // Head timeout counts from its first byte
+                        if(!rest.empty() && session.state == http_session_state::next_request)
+                            await(session, http_session_state::head,
+                                  options_.header_read_timeout);
+                        return {handled};
+                    case http_parse_status::error:
+                        return {handled, reject(session.socket, int(parsed.error))};
+                    case http_parse_status::complete:
+                        break;
+                }
+                auto& request = request_;
+                session.parser.extract(rest, request);
+                auto const head_size = parsed.consumed;
+                auto body_size = size_type{0};
+                auto const content_length = request.headers[http_header::content_length];
+                if(!content_length.empty()) {
+                    auto const converted = std::from_chars(content_length.data(),
+                                                           content_length.data()
+                                                           + content_length.size(),
+                                                           body_size);
+                    if(converted.ec != std::errc{}
+                       || converted.ptr != content_length.data() + content_length.size())
+                        return {handled, reject(session.socket, 400)};
+                    // Whole request should fit in receive buffer
+                    if(body_size > max_body_size
+                       || head_size + body_size > options_.tcp.rx_buffer_limit)
+                        return {handled, reject(session.socket, 413)};
+                }
+                if(rest.size() - head_size < body_size) {
+                    if(session.state != http_session_state::body)
+                        await(session, http_session_state::body, options_.body_read_timeout);
+                    return {handled};
+                }
+                request.body = rest.substr(head_size, body_size);
+                if(closing_requested(request))
+                    session.close_after_response = true;
+                ++session.responses_pending;
+                dispatching_ = session.socket;
+                observer_->on_request(session.socket, request);
+                dispatching_ = -1;
+                handled += head_size + body_size;
+                session.parser.reset();
+                await(session, http_session_state::next_request, options_.keep_alive_timeout);
+                if(session.close_after_response) {
+                    // Requests pipelined after the last one are not answered
+                    return {input.size(), session.responses_pending == 0u
+                        ? tcp_response::close_connection
+                        : tcp_response::await_next_data};
+                }
+            }
         }
 
-        virtual void on_disconnected(int) override {
 
+        void await(http_session& session,
+                   http_session_state state,
+                   std::chrono::milliseconds timeout) noexcept {
+            session.state = state;
+            tcp_server_.set_timeout(session.socket, timeout);
         }
 
-        virtual tcp_response on_data_ready(int) override {
+
+        virtual bool on_connected(int client_socket, sockaddr_in const&) override {
+            tcp_server_.set_timeout(client_socket, options_.header_read_timeout);
+            return true;
+        }
+
+
+        virtual void on_disconnected(int client_socket) override {
+            auto* connection = tcp_server_.connection(client_socket);
+            if(connection == nullptr || connection->context == nullptr)
+                return;
+            sessions_.recycle(http_session_ptr{static_cast<http_session*>(connection->context)});
+            connection->context = nullptr;
+        }
+
+
+        virtual tcp_consumed on_data(int client_socket, std::span<char const> data) override {
+            auto& session = session_of(client_socket);
+            auto const consumed = handle_requests(session,
+                                                  std::string_view{data.data(), data.size()});
+            if(releasing() && consumed.bytes == data.size())
+                session.parser.release();
+            return consumed;
+        }
+
+
+        virtual tcp_response on_timeout(int client_socket) override {
+            auto* connection = tcp_server_.connection(client_socket);
+            auto const* session = static_cast<http_session const*>(connection->context);
+            if(session == nullptr || session->state == http_session_state::next_request
+               || (session->state == http_session_state::head && connection->rx.empty()))
+                return tcp_response::close_connection;
+            return reject(client_socket, 408);
+        }
+
+
+        virtual tcp_response on_draining(int client_socket) override {
+            auto* connection = tcp_server_.connection(client_socket);
+            auto* session = static_cast<http_session*>(connection->context);
+            // Idle connection has nothing to answer
+            if(session == nullptr
+               || (session->responses_pending == 0u && connection->rx.empty()))
+                return tcp_response::close_connection;
+            session->close_after_response = true;
             return tcp_response::await_next_data;
         }
     }; // http_server
 
 } // namespace inter::http
-
@@ -8,25 +8,38 @@
 #include <netinet/in.h>
 
 #include <memory>
-#include <string>
 #include <vector>
 
+#include <inter/http_parser.hpp>
+
 
 namespace inter {
 
+    // What session is waiting for from the client
+    enum class http_session_state {
+        head, body, next_request
+    }; // http_session_state
+
+
     struct http_session {
 
         using size_type = std::size_t;
 
         int socket;
         sockaddr_in address;
-        std::string rx_buffer;
-        std::string tx_buffer;
-
-        http_session(size_type rx_buffer_capacity,
-                     size_type tx_buffer_capacity) {
-            rx_buffer.reserve(rx_buffer_capacity);
-            tx_buffer.reserve(tx_buffer_capacity);
+        // Head of the first request not handled yet parsed so far, its
+        // bytes stay in receive buffer of the connection
+        http_parser parser{};
+        http_session_state state{http_session_state::head};
+        // Requests passed to observer and not answered yet
+        size_type responses_pending{0u};
+        // Connection is closed when pending responses are sent
+        bool close_after_response{false};
+
+        http_session() = default;
+
+        explicit http_session(size_type max_head_size) noexcept
+            : parser{max_head_size} {
         }
 
         http_session(http_session const&) = delete;
@@ -42,23 +55,26 @@ namespace inter {
     class http_sessions_pool {
 
         std::vector<http_session_ptr> sessions_;
+        // Head limit of parsers of new sessions
+        std::size_t max_head_size_{http_parser::default_max_head_size};
 
     public:
 
-        using size_type = std::size_t;
-
         http_sessions_pool() = default;
+
+        explicit http_sessions_pool(std::size_t max_head_size) noexcept
+            : max_head_size_{max_head_size} {
+        }
+
         http_sessions_pool(http_sessions_pool const&) = delete;
         http_sessions_pool& operator = (http_sessions_pool const&) = delete;
         http_sessions_pool(http_sessions_pool&&) = default;
         http_sessions_pool& operator = (http_sessions_pool&&) = default;
 
 
-        http_session_ptr use(size_type rx_buffer_capacity,
-                             size_type tx_buffer_capacity) {
+        http_session_ptr use() {
             if(sessions_.empty())
-                return std::make_unique<http_session>(rx_buffer_capacity,
-                                                      tx_buffer_capaciy);
+                return std::make_unique<http_session>(max_head_size_);
             auto ptr = std::move(sessions_.back());
             sessions_.pop_back();
             return ptr;
@@ -66,6 +82,10 @@ namespace inter {
 
 
         void recycle(http_session_ptr ptr) {
+            ptr->parser.reset();
+            ptr->state = http_session_state::head;
+            ptr->responses_pending = 0u;
+            ptr->close_after_response = false;
             sessions_.push_back(std::move(ptr));
         }
 
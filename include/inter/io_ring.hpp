@@ -0,0 +1,355 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <span>
+#include <system_error>
+#include <utility>
+
+
+namespace inter {
+
+
+    // Minimal io_uring submission/completion rings on top of raw syscalls
+    class io_ring {
+        int fd_{-1};
+        void* sq_ring_{nullptr};
+        std::size_t sq_ring_size_{0u};
+        void* cq_ring_{nullptr};
+        std::size_t cq_ring_size_{0u};
+        io_uring_sqe* sqes_{nullptr};
+        std::size_t sqes_size_{0u};
+        unsigned* sq_head_{nullptr};
+        unsigned* sq_tail_{nullptr};
+        unsigned* sq_array_{nullptr};
+        unsigned sq_mask_{0u};
+        unsigned sq_entries_{0u};
+        unsigned* cq_head_{nullptr};
+        unsigned* cq_tail_{nullptr};
+        io_uring_cqe* cqes_{nullptr};
+        unsigned cq_mask_{0u};
+        unsigned sq_local_tail_{0u};
+        unsigned to_submit_{0u};
+
+    public:
+
+        io_ring() = default;
+        io_ring(io_ring const&) = delete;
+        io_ring& operator = (io_ring const&) = delete;
+        ~io_ring() { close(); }
+
+
+        io_ring(io_ring&& other) noexcept {
+            swap(other);
+        }
+
+
+        io_ring& operator = (io_ring&& other) noexcept {
+            if(this == &other)
+                return *this;
+            close();
+            swap(other);
+            return *this;
+        }
+
+
+        int descriptor() const noexcept {
+            return fd_;
+        }
+
+
+        bool is_open() const noexcept {
+            return fd_ != -1;
+        }
+
+
+        std::expected<void, std::error_code> open(unsigned entries) noexcept {
+            close();
+            auto params = io_uring_params{};
+            params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+            params.cq_entries = entries * 4;
+            auto const fd = int(::syscall(__NR_io_uring_setup, entries, &params));
+            if(fd == -1)
+                return unexpected_from_errno();
+            fd_ = fd;
+            if(!(params.features & IORING_FEAT_EXT_ARG)) {
+                close();
+                return std::unexpected(std::make_error_code(std::errc::not_supported));
+            }
+            sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if(params.features & IORING_FEAT_SINGLE_MMAP)
+                sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+            auto* sq_ring = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+            if(sq_ring == MAP_FAILED)
+                return close_on_error();
+            sq_ring_ = sq_ring;
+            if(params.features & IORING_FEAT_SINGLE_MMAP) {
+                cq_ring_ = sq_ring_;
+            } else {
+                auto* cq_ring = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+                if(cq_ring == MAP_FAILED)
+                    return close_on_error();
+                cq_ring_ = cq_ring;
+            }
+            sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+            auto* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+            if(sqes == MAP_FAILED)
+                return close_on_error();
+            sqes_ = static_cast<io_uring_sqe*>(sqes);
+            auto* sq = static_cast<char*>(sq_ring_);
+            sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+            sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sq_entries_ = params.sq_entries;
+            sq_local_tail_ = *sq_tail_;
+            auto* cq = static_cast<char*>(cq_ring_);
+            cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            to_submit_ = 0u;
+            return {};
+        }
+
+
+        void close() noexcept {
+            if(sqes_ != nullptr)
+                ::munmap(sqes_, sqes_size_);
+            if(cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+                ::munmap(cq_ring_, cq_ring_size_);
+            if(sq_ring_ != nullptr)
+                ::munmap(sq_ring_, sq_ring_size_);
+            if(fd_ != -1)
+                ::close(fd_);
+            fd_ = -1;
+            sq_ring_ = nullptr;
+            cq_ring_ = nullptr;
+            sqes_ = nullptr;
+            to_submit_ = 0u;
+        }
+
+
+        // Returns nullptr when submission queue is full
+        io_uring_sqe* next_sqe() noexcept {
+            auto const head = std::atomic_ref<unsigned>{*sq_head_}
+                .load(std::memory_order_acquire);
+            if(sq_local_tail_ - head >= sq_entries_)
+                return nullptr;
+            auto const index = sq_local_tail_ & sq_mask_;
+            auto* sqe = &sqes_[index];
+            std::memset(sqe, 0, sizeof(io_uring_sqe));
+            sq_array_[index] = index;
+            ++sq_local_tail_;
+            ++to_submit_;
+            return sqe;
+        }
+
+
+        unsigned pending() const noexcept {
+            return to_submit_;
+        }
+
+
+        // Submits all prepared entries in one call and waits for at least
+        // 'wait_count' completions or until timeout expires
+        std::expected<void, std::error_code>
+        submit(unsigned wait_count = 0u, int timeout_ms = -1) noexcept {
+            std::atomic_ref<unsigned>{*sq_tail_}
+                .store(sq_local_tail_, std::memory_order_release);
+            auto flags = 0u;
+            auto ts = __kernel_timespec{};
+            auto arg = io_uring_getevents_arg{};
+            void* arg_ptr = nullptr;
+            auto arg_size = std::size_t{0u};
+            if(wait_count != 0u) {
+                flags |= IORING_ENTER_GETEVENTS;
+                if(timeout_ms >= 0) {
+                    ts.tv_sec = timeout_ms / 1000;
+                    ts.tv_nsec = (timeout_ms % 1000) * 1000000ll;
+                    arg.sigmask_sz = _NSIG / 8;
+                    arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+                    flags |= IORING_ENTER_EXT_ARG;
+                    arg_ptr = &arg;
+                    arg_size = sizeof(arg);
+                }
+            }
+            if(to_submit_ == 0u && wait_count == 0u)
+                return {};
+            auto const submitted = ::syscall(__NR_io_uring_enter, fd_, to_submit_,
+                                             wait_count, flags, arg_ptr, arg_size);
+            if(submitted == -1) {
+                if(errno == ETIME || errno == EINTR || errno == EBUSY)
+                    return {};
+                return unexpected_from_errno();
+            }
+            to_submit_ -= unsigned(submitted);
+            return {};
+        }
+
+
+        // Submits prepared entries and lets kernel post completions ready
+        // without waiting for any, enters kernel only if there is nothing
+        // to complete already
+        std::expected<void, std::error_code> peek() noexcept {
+            auto const tail = std::atomic_ref<unsigned>{*cq_tail_}
+                .load(std::memory_order_acquire);
+            if(to_submit_ == 0u && tail != *cq_head_)
+                return {};
+            std::atomic_ref<unsigned>{*sq_tail_}
+                .store(sq_local_tail_, std::memory_order_release);
+            auto const submitted = ::syscall(__NR_io_uring_enter, fd_, to_submit_,
+                                             0u, IORING_ENTER_GETEVENTS, nullptr, 0u);
+            if(submitted == -1) {
+                if(errno == EINTR || errno == EBUSY)
+                    return {};
+                return unexpected_from_errno();
+            }
+            to_submit_ -= unsigned(submitted);
+            return {};
+        }
+
+
+        template<typename F> unsigned complete(F&& handler) {
+            auto head = *cq_head_;
+            auto const tail = std::atomic_ref<unsigned>{*cq_tail_}
+                .load(std::memory_order_acquire);
+            auto count = 0u;
+            for(; head != tail; ++head, ++count) {
+                auto const cqe = cqes_[head & cq_mask_];
+                std::atomic_ref<unsigned>{*cq_head_}
+                    .store(head + 1, std::memory_order_release);
+                handler(cqe);
+            }
+            return count;
+        }
+
+
+    private:
+
+        void swap(io_ring& other) noexcept {
+            std::swap(fd_, other.fd_);
+            std::swap(sq_ring_, other.sq_ring_);
+            std::swap(sq_ring_size_, other.sq_ring_size_);
+            std::swap(cq_ring_, other.cq_ring_);
+            std::swap(cq_ring_size_, other.cq_ring_size_);
+            std::swap(sqes_, other.sqes_);
+            std::swap(sqes_size_, other.sqes_size_);
+            std::swap(sq_head_, other.sq_head_);
+            std::swap(sq_tail_, other.sq_tail_);
+            std::swap(sq_array_, other.sq_array_);
+            std::swap(sq_mask_, other.sq_mask_);
+            std::swap(sq_entries_, other.sq_entries_);
+            std::swap(cq_head_, other.cq_head_);
+            std::swap(cq_tail_, other.cq_tail_);
+            std::swap(cqes_, other.cqes_);
+            std::swap(cq_mask_, other.cq_mask_);
+            std::swap(sq_local_tail_, other.sq_local_tail_);
+            std::swap(to_submit_, other.to_submit_);
+        }
+
+
+        static std::unexpected<std::error_code> unexpected_from_errno() noexcept {
+            return std::unexpected(std::error_code{errno, std::system_category()});
+        }
+
+
+        std::unexpected<std::error_code> close_on_error() noexcept {
+            auto const error = unexpected_from_errno();
+            close();
+            return error;
+        }
+
+    }; // io_ring
+
+
+    // Buffers of one group kernel picks from for receive operations
+    // submitted with IOSQE_BUFFER_SELECT. Picked buffer is given back to
+    // kernel with provide() once its bytes are handled. Buffers are given
+    // by IORING_OP_PROVIDE_BUFFERS, not by a ring registered with
+    // IORING_REGISTER_PBUF_RING: on kernels it was tried (6.18) the ring
+    // is registered, but receives from it fail with ENOBUFS. Buffers given
+    // back go with other submissions and cost no system calls of their own
+    class io_buffer_group {
+        std::unique_ptr<char[]> memory_;
+        unsigned count_{0u};
+        unsigned buffer_size_{0u};
+        std::uint16_t group_{0u};
+
+    public:
+
+        static constexpr auto max_count = 65536u;
+
+
+        bool is_open() const noexcept {
+            return memory_ != nullptr;
+        }
+
+
+        std::uint16_t group() const noexcept {
+            return group_;
+        }
+
+
+        unsigned count() const noexcept {
+            return count_;
+        }
+
+
+        // Memory for 'count' buffers of 'buffer_size' bytes, none of them
+        // is given to kernel yet
+        void open(std::uint16_t group, unsigned count, unsigned buffer_size) {
+            count_ = std::min(count, max_count);
+            buffer_size_ = buffer_size;
+            group_ = group;
+            memory_.reset(new char[std::size_t(count_) * buffer_size_]);
+        }
+
+
+        // Kernel should not hold any buffer, e.g. the ring is closed
+        void close() noexcept {
+            memory_.reset();
+            count_ = 0u;
+        }
+
+
+        // Makes 'sqe' give 'count' buffers from 'id' on to kernel
+        void provide(io_uring_sqe& sqe, unsigned id, unsigned count = 1u) const noexcept {
+            sqe.opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe.fd = int(count);
+            sqe.addr = reinterpret_cast<std::uint64_t>(memory_.get()
+                                                       + std::size_t(id) * buffer_size_);
+            sqe.len = buffer_size_;
+            sqe.off = id;
+            sqe.buf_group = group_;
+        }
+
+
+        // Bytes received into buffer 'id' of completion
+        std::span<char const> received(unsigned id, std::size_t size) const noexcept {
+            return {memory_.get() + std::size_t(id) * buffer_size_, size};
+        }
+
+    }; // io_buffer_group
+
+} // namespace inter
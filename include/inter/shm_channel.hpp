@@ -0,0 +1,512 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <new>
+#include <span>
+#include <system_error>
+#include <utility>
+
+#include <inter/tcp_handoff.hpp>
+
+
+namespace inter {
+
+
+    namespace detail {
+
+        // Cursors of one direction are on their own cache lines, so
+        // producer and consumer do not write the same line
+        struct shm_cursors {
+            // Bytes read by consumer
+            alignas(64) std::atomic<std::uint64_t> head{0u};
+            // Bytes written by producer
+            alignas(64) std::atomic<std::uint64_t> tail{0u};
+        }; // shm_cursors
+
+        static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+
+        // Beginning of the shared region, rings data follow it
+        struct shm_header {
+            static constexpr auto signature = std::uint64_t{0x696e7465722d7368};
+
+            std::uint64_t magic{signature};
+            std::uint64_t capacity;
+            // Ring 'i' is read by side 'i'
+            shm_cursors cursors[2];
+            // What side sleeping on its eventfd is waiting for
+            alignas(64) std::atomic<std::uint32_t> waiting[2]{};
+            std::atomic<std::uint32_t> closed[2]{};
+
+            explicit shm_header(std::uint64_t capacity) noexcept: capacity{capacity} { }
+        }; // shm_header
+
+    } // namespace detail
+
+
+    // Single producer single consumer byte ring over shared memory,
+    // capacity is a power of two. Side keeps its own cursor privately and
+    // checks the one of the peer, since peer can write anything there
+    class shm_ring {
+        detail::shm_cursors* cursors_{nullptr};
+        char* data_{nullptr};
+        std::uint64_t capacity_{0u};
+        // Head for consumer, tail for producer
+        std::uint64_t own_{0u};
+        // Set by any call finding peer's cursor out of range
+        mutable bool corrupted_{false};
+
+    public:
+
+        using size_type = std::size_t;
+
+        shm_ring() noexcept = default;
+
+        shm_ring(detail::shm_cursors& cursors, char* data, std::uint64_t capacity) noexcept
+            : cursors_{&cursors}, data_{data}, capacity_{capacity} {
+        }
+
+
+        size_type capacity() const noexcept {
+            return size_type(capacity_);
+        }
+
+
+        // Peer has moved its cursor before this side's one or too far
+        // after it, ring is not used any more then
+        bool corrupted() const noexcept {
+            return corrupted_;
+        }
+
+
+        // Consumer side
+        size_type readable() const noexcept {
+            auto const count = cursors_->tail.load(std::memory_order_acquire) - own_;
+            if(corrupted_ || count > capacity_) {
+                corrupted_ = true;
+                return 0u;
+            }
+            return size_type(count);
+        }
+
+
+        // Producer side
+        size_type writable() const noexcept {
+            auto const count = own_ - cursors_->head.load(std::memory_order_acquire);
+            if(corrupted_ || count > capacity_) {
+                corrupted_ = true;
+                return 0u;
+            }
+            return size_type(capacity_ - count);
+        }
+
+
+        // Copies as many bytes as fit, returns their number
+        size_type write(std::span<char const> bytes) noexcept {
+            auto const tail = own_;
+            auto const used = tail - cursors_->head.load(std::memory_order_acquire);
+            if(corrupted_ || used > capacity_) {
+                corrupted_ = true;
+                return 0u;
+            }
+            auto const count = std::min<std::uint64_t>(bytes.size(), capacity_ - used);
+            auto const offset = tail & (capacity_ - 1);
+            auto const first = std::min(count, capacity_ - offset);
+            std::memcpy(data_ + offset, bytes.data(), first);
+            std::memcpy(data_, bytes.data() + first, count - first);
+            own_ = tail + count;
+            cursors_->tail.store(own_, std::memory_order_release);
+            return size_type(count);
+        }
+
+
+        // Copies as many bytes as received, returns their number
+        size_type read(std::span<char> bytes) noexcept {
+            auto const head = own_;
+            auto const received = cursors_->tail.load(std::memory_order_acquire) - head;
+            if(corrupted_ || received > capacity_) {
+                corrupted_ = true;
+                return 0u;
+            }
+            auto const count = std::min<std::uint64_t>(bytes.size(), received);
+            auto const offset = head & (capacity_ - 1);
+            auto const first = std::min(count, capacity_ - offset);
+            std::memcpy(bytes.data(), data_ + offset, first);
+            std::memcpy(bytes.data() + first, data_, count - first);
+            own_ = head + count;
+            cursors_->head.store(own_, std::memory_order_release);
+            return size_type(count);
+        }
+
+    }; // shm_ring
+
+
+    // What side sleeping on its eventfd waits for
+    enum shm_waiting : std::uint32_t {
+        shm_waiting_data = 1u, shm_waiting_space = 2u
+    }; // shm_waiting
+
+
+    // One side of a pair of rings shared by two processes on the same host.
+    // Bytes go without system calls; peer is notified through its eventfd
+    // only when it sleeps waiting for them. Unix domain socket the region
+    // was passed through stays open and tells that the peer is gone
+    class shm_channel {
+        int socket_{-1};
+        // Woken up by peer, peer's one
+        int event_{-1};
+        int peer_event_{-1};
+        void* region_{nullptr};
+        std::size_t region_size_{0u};
+        int side_{0};
+        bool hung_up_{false};
+        shm_ring rx_;
+        shm_ring tx_;
+
+    public:
+
+        using size_type = std::size_t;
+
+        static constexpr auto default_capacity = size_type{1024 * 1024};
+        static constexpr auto max_capacity = size_type{1} << 30;
+
+        shm_channel() noexcept = default;
+        shm_channel(shm_channel const&) = delete;
+        shm_channel& operator = (shm_channel const&) = delete;
+
+        shm_channel(shm_channel&& other) noexcept {
+            swap(other);
+        }
+
+        shm_channel& operator = (shm_channel&& other) noexcept {
+            shm_channel{std::move(other)}.swap(*this);
+            return *this;
+        }
+
+        ~shm_channel() { close(); }
+
+
+        // Server side: creates region with rings of 'capacity' bytes each
+        // (rounded up to a power of two) and passes it to the client
+        // connected to 'socket'. Channel owns the socket
+        static std::expected<shm_channel, std::error_code>
+        offer(int socket, size_type capacity = default_capacity) {
+            auto channel = shm_channel{};
+            channel.socket_ = socket;
+            capacity = std::bit_ceil(std::clamp(capacity, size_type{4096}, max_capacity));
+            auto const region = ::memfd_create("inter-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+            if(region == -1)
+                return std::unexpected(std::error_code{errno, std::system_category()});
+            auto const size = region_size(capacity);
+            auto client_event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            channel.event_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            auto const opened = client_event != -1 && channel.event_ != -1
+                && ::ftruncate(region, off_t(size)) != -1
+                && ::fcntl(region, F_ADD_SEALS, region_seals) != -1
+                && channel.map(region, size, 0)
+                && send_region(socket, region, client_event, channel.event_, capacity);
+            auto const error = std::error_code{errno, std::system_category()};
+            ::close(region);
+            channel.peer_event_ = client_event;
+            if(!opened)
+                return std::unexpected(error);
+            return channel;
+        }
+
+
+        // Client side: connects to tcp_server::listen_shm() at 'path'
+        static std::expected<shm_channel, std::error_code>
+        connect(char const* path) {
+            auto const socket = connect_handoff_channel(path);
+            if(!socket)
+                return std::unexpected(socket.error());
+            auto channel = shm_channel{};
+            channel.socket_ = *socket;
+            int descriptors[3] = {-1, -1, -1};
+            auto capacity = std::uint64_t{0};
+            if(auto received = receive_region(*socket, descriptors, capacity); !received)
+                return std::unexpected(received.error());
+            channel.event_ = descriptors[1];
+            channel.peer_event_ = descriptors[2];
+            struct stat status{};
+            auto const valid = capacity != 0u && capacity <= max_capacity
+                && std::has_single_bit(capacity)
+                && sealed(descriptors[0])
+                && ::fstat(descriptors[0], &status) != -1
+                && std::uint64_t(status.st_size) == region_size(size_type(capacity));
+            auto const mapped = valid && channel.map(descriptors[0], region_size(size_type(capacity)), 1);
+            ::close(descriptors[0]);
+            if(!mapped || channel.header().magic != detail::shm_header::signature
+               || channel.header().capacity != capacity)
+                return std::unexpected(std::make_error_code(std::errc::bad_message));
+            return channel;
+        }
+
+
+        int socket() const noexcept {
+            return socket_;
+        }
+
+
+        // Becomes readable when peer notifies this side
+        int event_descriptor() const noexcept {
+            return event_;
+        }
+
+
+        size_type readable() const noexcept {
+            return rx_.readable();
+        }
+
+
+        size_type writable() const noexcept {
+            return tx_.writable();
+        }
+
+
+        // Peer has closed its side, its socket is hung up or it has broken
+        // the rings. Bytes written before closing are readable still
+        bool peer_closed() const noexcept {
+            return hung_up_ || corrupted()
+                || header().closed[1 - side_].load(std::memory_order_acquire) != 0u;
+        }
+
+
+        // Peer has moved ring cursor it does not own, which is protocol
+        // error: channel should be closed
+        bool corrupted() const noexcept {
+            return rx_.corrupted() || tx_.corrupted();
+        }
+
+
+        // Socket reports that peer process is gone without closing its side
+        void hang_up() noexcept {
+            hung_up_ = true;
+        }
+
+
+        // Returns number of bytes written, peer is notified if it waits
+        size_type write(std::span<char const> bytes) noexcept {
+            auto const written = tx_.write(bytes);
+            if(written != 0u)
+                notify(shm_waiting_data);
+            return written;
+        }
+
+
+        // Returns number of bytes read, peer is notified if it waits for
+        // space to write
+        size_type read(std::span<char> bytes) noexcept {
+            auto const received = rx_.read(bytes);
+            if(received != 0u)
+                notify(shm_waiting_space);
+            return received;
+        }
+
+
+        // Side is going to sleep on its eventfd until peer writes or reads.
+        // Returns false if it should not, since there is something already
+        bool wait_for(std::uint32_t waiting) noexcept {
+            header().waiting[side_].store(waiting, std::memory_order_seq_cst);
+            if(((waiting & shm_waiting_data) != 0u && rx_.readable() != 0u)
+               || ((waiting & shm_waiting_space) != 0u && tx_.writable() != 0u)
+               || peer_closed())
+                return false;
+            return true;
+        }
+
+
+        // Side polls its rings and needs no notifications
+        void stop_waiting() noexcept {
+            header().waiting[side_].store(0u, std::memory_order_relaxed);
+        }
+
+
+        // Resets notifications received
+        void clear_event() noexcept {
+            auto counter = std::uint64_t{0};
+            (void)::read(event_, &counter, sizeof(counter));
+        }
+
+
+        // Blocks until peer reads, writes or closes, or 'timeout_ms' passes.
+        // For clients without their own event loop
+        bool wait(std::uint32_t waiting, int timeout_ms = -1) noexcept {
+            if(!wait_for(waiting)) {
+                stop_waiting();
+                return true;
+            }
+            pollfd descriptors[2] = {
+                {.fd = event_, .events = POLLIN, .revents = 0},
+                {.fd = socket_, .events = POLLRDHUP, .revents = 0}
+            };
+            auto const polled = ::poll(descriptors, 2, timeout_ms);
+            stop_waiting();
+            clear_event();
+            return polled > 0;
+        }
+
+
+        void close() noexcept {
+            if(region_ != nullptr) {
+                header().closed[side_].store(1u, std::memory_order_release);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(header().waiting[1 - side_].load(std::memory_order_relaxed) != 0u)
+                    signal(peer_event_);
+                ::munmap(region_, region_size_);
+                region_ = nullptr;
+            }
+            for(auto* descriptor: {&socket_, &event_, &peer_event_})
+                if(*descriptor != -1) {
+                    ::close(*descriptor);
+                    *descriptor = -1;
+                }
+        }
+
+    private:
+
+        // Region size is fixed for good, so peer can not truncate it under
+        // the mapping and fault this side with SIGBUS
+        static constexpr auto region_seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+        static size_type region_size(size_type capacity) noexcept {
+            return sizeof(detail::shm_header) + 2 * capacity;
+        }
+
+
+        static bool sealed(int region) noexcept {
+            auto const seals = ::fcntl(region, F_GET_SEALS);
+            return seals != -1 && (seals & region_seals) == region_seals;
+        }
+
+
+        detail::shm_header& header() const noexcept {
+            return *static_cast<detail::shm_header*>(region_);
+        }
+
+
+        bool map(int region, size_type size, int side) noexcept {
+            auto* const mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED, region, 0);
+            if(mapped == MAP_FAILED)
+                return false;
+            region_ = mapped;
+            region_size_ = size;
+            side_ = side;
+            auto const capacity = (size - sizeof(detail::shm_header)) / 2;
+            if(side == 0)
+                new (region_) detail::shm_header{capacity};
+            auto* const data = static_cast<char*>(region_) + sizeof(detail::shm_header);
+            rx_ = shm_ring{header().cursors[side], data + side * capacity, capacity};
+            tx_ = shm_ring{header().cursors[1 - side], data + (1 - side) * capacity, capacity};
+            return true;
+        }
+
+
+        void notify(std::uint32_t reason) noexcept {
+            // Pairs with the store of wait_for(), so either peer sees the
+            // bytes or this side sees peer waiting
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto& waiting = header().waiting[1 - side_];
+            if((waiting.load(std::memory_order_relaxed) & reason) != 0u)
+                signal(peer_event_);
+        }
+
+
+        static void signal(int event) noexcept {
+            auto const one = std::uint64_t{1};
+            (void)::write(event, &one, sizeof(one));
+        }
+
+
+        static bool send_region(int socket, int region, int client_event, int server_event,
+                                std::uint64_t capacity) noexcept {
+            int const descriptors[3] = {region, client_event, server_event};
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(descriptors))] = {};
+            auto payload = iovec{.iov_base = &capacity, .iov_len = sizeof(capacity)};
+            auto message = msghdr{};
+            message.msg_iov = &payload;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            auto* cmsg = CMSG_FIRSTHDR(&message);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(descriptors));
+            std::memcpy(CMSG_DATA(cmsg), descriptors, sizeof(descriptors));
+            for(;;) {
+                if(::sendmsg(socket, &message, MSG_NOSIGNAL | MSG_DONTWAIT) != -1)
+                    return true;
+                if(errno != EINTR)
+                    return false;
+            }
+        }
+
+
+        static std::expected<void, std::error_code>
+        receive_region(int socket, int (&descriptors)[3], std::uint64_t& capacity) noexcept {
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(descriptors))] = {};
+            auto payload = iovec{.iov_base = &capacity, .iov_len = sizeof(capacity)};
+            auto message = msghdr{};
+            message.msg_iov = &payload;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            auto received = ssize_t{-1};
+            do
+                received = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+            while(received == -1 && errno == EINTR);
+            if(received == -1)
+                return std::unexpected(std::error_code{errno, std::system_category()});
+            auto* cmsg = CMSG_FIRSTHDR(&message);
+            if(cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET
+               || cmsg->cmsg_type != SCM_RIGHTS)
+                return std::unexpected(std::make_error_code(std::errc::bad_message));
+            auto const count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            std::memcpy(descriptors, CMSG_DATA(cmsg), std::min(count, std::size(descriptors))
+                                                      * sizeof(int));
+            if(count != std::size(descriptors) || std::size_t(received) != sizeof(capacity)
+               || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0) {
+                for(auto i = std::size_t{0}; i != std::min(count, std::size(descriptors)); ++i)
+                    ::close(descriptors[i]);
+                return std::unexpected(std::make_error_code(std::errc::bad_message));
+            }
+            return {};
+        }
+
+
+        void swap(shm_channel& other) noexcept {
+            std::swap(socket_, other.socket_);
+            std::swap(event_, other.event_);
+            std::swap(peer_event_, other.peer_event_);
+            std::swap(region_, other.region_);
+            std::swap(region_size_, other.region_size_);
+            std::swap(side_, other.side_);
+            std::swap(hung_up_, other.hung_up_);
+            std::swap(rx_, other.rx_);
+            std::swap(tx_, other.tx_);
+        }
+
+    }; // shm_channel
+
+} // namespace inter
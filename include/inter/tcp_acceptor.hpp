@@ -0,0 +1,258 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <limits>
+#include <system_error>
+#include <thread>
+
+#include <inter/tcp_reactors.hpp>
+#include <inter/tcp_server.hpp>
+
+
+namespace inter {
+
+
+    enum class tcp_placement {
+        round_robin, least_loaded
+    }; // tcp_placement
+
+
+    // Accepts connections on a dedicated thread and hands them over to
+    // worker reactors, so placement does not depend on SO_REUSEPORT hashing
+    class tcp_acceptor {
+    public:
+
+        using size_type = std::size_t;
+        using observer_factory = tcp_reactors::observer_factory;
+
+    private:
+
+        tcp_reactors workers_;
+        // Busy polling options are set on listening socket, so accepted
+        // sockets inherit them
+        tcp_server_options options_{};
+        tcp_placement placement_{tcp_placement::round_robin};
+        std::size_t accept_batch_{tcp_server_options{}.accept_batch};
+        int spare_fd_{detail::open_spare_descriptor()};
+        // Breaks waiting for connections on stop and drain
+        int wakeup_{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+        std::atomic<bool> stopping_{false};
+        std::atomic<bool> draining_{false};
+        std::atomic<std::int64_t> drain_timeout_{0};
+        std::thread thread_;
+        std::expected<void, std::error_code> result_;
+        size_type next_worker_{0u};
+
+    public:
+
+        tcp_acceptor() = default;
+
+        explicit tcp_acceptor(tcp_engine engine,
+                              tcp_placement placement = tcp_placement::round_robin) noexcept
+            : workers_{engine}, placement_{placement} {
+        }
+
+        explicit tcp_acceptor(tcp_server_options const& options,
+                              tcp_placement placement = tcp_placement::round_robin) noexcept
+            : workers_{options}, options_{options}, placement_{placement},
+              accept_batch_{options.accept_batch} {
+        }
+
+        tcp_acceptor(tcp_acceptor const&) = delete;
+        tcp_acceptor& operator = (tcp_acceptor const&) = delete;
+        tcp_acceptor(tcp_acceptor&&) = delete;
+        tcp_acceptor& operator = (tcp_acceptor&&) = delete;
+        ~tcp_acceptor() {
+            stop();
+            join();
+            if(spare_fd_ != -1)
+                ::close(spare_fd_);
+            if(wakeup_ != -1)
+                ::close(wakeup_);
+        }
+
+
+        tcp_reactors& workers() noexcept {
+            return workers_;
+        }
+
+
+        // Opens listening socket on the calling thread, starts 'count'
+        // workers and acceptor thread
+        std::expected<void, std::error_code>
+        start(std::int16_t port,
+              size_type count,
+              observer_factory const& make_observer,
+              int connection_requests_limit = tcp_server::default_connection_requests_limit) {
+            if(thread_.joinable() || count == 0)
+                return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+            auto const server_socket = tcp_server::open_listener(port, options_.socket,
+                                                                 connection_requests_limit);
+            if(!server_socket)
+                return std::unexpected(server_socket.error());
+            return start_serving(*server_socket, count, make_observer);
+        }
+
+
+        // Same for Unix domain socket, which can not be shared by reactors
+        // with SO_REUSEPORT
+        std::expected<void, std::error_code>
+        start_unix(char const* path,
+                   size_type count,
+                   observer_factory const& make_observer,
+                   int connection_requests_limit = tcp_server::default_connection_requests_limit) {
+            if(thread_.joinable() || count == 0)
+                return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+            auto const server_socket = tcp_server::open_unix_listener(path,
+                                                                      connection_requests_limit);
+            if(!server_socket)
+                return std::unexpected(server_socket.error());
+            return start_serving(*server_socket, count, make_observer);
+        }
+
+
+        // Can be called from any thread
+        void stop() noexcept {
+            stopping_ = true;
+            wake_up();
+            workers_.stop();
+        }
+
+
+        // Hands over connections waiting in the listening queue already and
+        // stops accepting, then workers finish their connections. Can be
+        // called from any thread
+        void drain(std::chrono::milliseconds timeout) noexcept {
+            drain_timeout_ = timeout.count();
+            draining_ = true;
+            stopping_ = true;
+            wake_up();
+        }
+
+
+        // Waits for acceptor and all workers, returns the first error if any
+        std::expected<void, std::error_code> join() {
+            if(thread_.joinable())
+                thread_.join();
+            auto const joined = workers_.join();
+            auto result = result_ ? joined : result_;
+            auto counter = std::uint64_t{};
+            (void)::read(wakeup_, &counter, sizeof(counter));
+            stopping_ = false;
+            draining_ = false;
+            result_ = {};
+            return result;
+        }
+
+
+    private:
+
+        std::expected<void, std::error_code>
+        start_serving(int server_socket, size_type count, observer_factory const& make_observer) {
+            if(wakeup_ == -1) {
+                ::close(server_socket);
+                return std::unexpected(std::make_error_code(std::errc::bad_file_descriptor));
+            }
+            if(auto tuned = detail::set_busy_poll(server_socket, options_); !tuned) {
+                ::close(server_socket);
+                return tuned;
+            }
+            if(auto started = workers_.start(count, make_observer); !started) {
+                ::close(server_socket);
+                return started;
+            }
+            thread_ = std::thread{[this, server_socket] {
+                result_ = run(server_socket);
+            }};
+            return {};
+        }
+
+
+        void wake_up() noexcept {
+            if(wakeup_ == -1)
+                return;
+            auto const one = std::uint64_t{1};
+            (void)::write(wakeup_, &one, sizeof(one));
+        }
+
+
+        void accept_connections(int server_socket, std::size_t limit) {
+            detail::accept_pending(server_socket, spare_fd_, limit,
+                                   [&](int client_socket, sockaddr_in const& client_addr) {
+                if(!hand_over(client_socket, client_addr))
+                    ::close(client_socket);
+            });
+        }
+
+
+        std::expected<void, std::error_code> run(int server_socket) {
+            pollfd fds[] = {
+                {.fd = server_socket, .events = POLLIN, .revents = 0},
+                {.fd = wakeup_, .events = POLLIN, .revents = 0}
+            };
+            while(!stopping_) {
+                auto const polled_count = ::poll(fds, 2, -1);
+                if(polled_count <= 0 || (fds[0].revents & POLLIN) == 0)
+                    continue;
+                accept_connections(server_socket, accept_batch_);
+            }
+            // Clients waiting in the listening queue would be reset
+            if(draining_)
+                accept_connections(server_socket, std::numeric_limits<std::size_t>::max());
+            ::close(server_socket);
+            // Workers drain once nothing is handed over to them anymore
+            if(draining_)
+                workers_.drain(std::chrono::milliseconds{drain_timeout_.load()});
+            return {};
+        }
+
+
+        bool hand_over(int client_socket, sockaddr_in const& client_addr) {
+            auto const count = workers_.size();
+            auto const first = choose_worker();
+            // Try the rest of workers if the chosen one has full handoff queue
+            for(auto i = size_type{0}; i != count; ++i) {
+                auto& worker = workers_.server((first + i) % count);
+                if(worker.adopt(client_socket, client_addr))
+                    return true;
+            }
+            return false;
+        }
+
+
+        size_type choose_worker() noexcept {
+            auto const count = workers_.size();
+            switch(placement_) {
+                case tcp_placement::round_robin:
+                    return next_worker_++ % count;
+                case tcp_placement::least_loaded: {
+                    auto chosen = size_type{0};
+                    auto chosen_load = workers_.server(0).connections_count();
+                    for(auto i = size_type{1}; i != count; ++i) {
+                        auto const load = workers_.server(i).connections_count();
+                        if(load < chosen_load) {
+                            chosen = i;
+                            chosen_load = load;
+                        }
+                    }
+                    return chosen;
+                }
+            }
+            return 0;
+        }
+
+    }; // tcp_acceptor
+
+} // namespace inter
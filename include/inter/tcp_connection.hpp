@@ -0,0 +1,290 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <inter/shm_channel.hpp>
+#include <inter/tcp_output.hpp>
+#include <inter/tcp_rx_buffer.hpp>
+#include <inter/timer_wheel.hpp>
+
+
+namespace inter {
+
+
+    // Identifies connection across threads, socket descriptor alone is not
+    // enough since it is reused as soon as connection is closed
+    struct tcp_connection_id {
+        int socket;
+        std::uint64_t generation;
+    }; // tcp_connection_id
+
+
+    struct tcp_connection {
+        int socket;
+        sockaddr_in address;
+        std::uint64_t generation{0u};
+        // Position in poll descriptors (poll engine only)
+        std::size_t poll_index{0u};
+        // Observer's own per-connection state
+        void* context{nullptr};
+        // Bytes received for tcp_data_observer and not consumed yet
+        tcp_rx_buffer rx{};
+        // Bytes not sent yet. With io_uring engine the first of them are
+        // in flight as described by tx_message
+        tcp_output tx{};
+        std::vector<iovec> tx_iovecs{};
+        msghdr tx_message{};
+        bool tx_in_flight{false};
+        // Bytes are queued without sending until output is released
+        bool tx_held{false};
+        // Reading stops while too many bytes are queued, readiness
+        // reported meanwhile is remembered
+        bool reading_paused{false};
+        bool read_pending{false};
+        bool close_after_flush{false};
+        // Bytes go through shared memory instead of the socket, which
+        // only tells that peer is gone (epoll engine only)
+        std::optional<shm_channel> shm{};
+        // Shared memory connection is listed to be served on the next turn
+        bool shm_ready{false};
+        // Timeout set by observer and timeout of sending queued bytes
+        timer_node timer{};
+        timer_node tx_timer{};
+        // io_uring engine: submitted operations not completed yet
+        // and cancellation in progress
+        int operations{0};
+        bool closing{false};
+        // io_uring engine: multishot receive is submitted
+        bool receiving{false};
+        // Set once connection is closed, events reported for it before
+        // are stale
+        bool closed{false};
+
+        tcp_connection_id id() const noexcept {
+            return {socket, generation};
+        }
+
+
+        std::size_t tx_queued() const noexcept {
+            return tx.size();
+        }
+    }; // tcp_connection
+
+    using tcp_connection_ptr = std::unique_ptr<tcp_connection>;
+
+
+    // Connections indexed by socket descriptor. Descriptors are small dense
+    // numbers, so lookup, insertion and removal are O(1); connection objects
+    // are recycled and keep their addresses while open
+    class tcp_connections {
+        std::vector<tcp_connection_ptr> slots_;
+        std::vector<tcp_connection_ptr> spare_;
+        // Connections closed while events reported for them may still
+        // be dispatched, kept apart until recycled
+        bool deferring_{false};
+        std::vector<tcp_connection_ptr> closed_;
+        std::uint64_t generation_{0u};
+        std::size_t size_{0u};
+        // Buffers returned by idle connections
+        bool releasing_{false};
+        std::vector<tcp_rx_buffer> spare_rx_;
+        std::vector<tcp_output> spare_tx_;
+        std::vector<std::vector<iovec>> spare_iovecs_;
+
+    public:
+
+        using size_type = std::size_t;
+
+        // Buffers kept for reuse at most, the rest are freed
+        static constexpr auto spare_buffers_limit = size_type{1024};
+
+        tcp_connections() = default;
+        tcp_connections(tcp_connections const&) = delete;
+        tcp_connections& operator = (tcp_connections const&) = delete;
+        tcp_connections(tcp_connections&&) = default;
+        tcp_connections& operator = (tcp_connections&&) = default;
+
+
+        size_type size() const noexcept {
+            return size_;
+        }
+
+
+        bool empty() const noexcept {
+            return size_ == 0u;
+        }
+
+
+        tcp_connection* find(int socket) const noexcept {
+            if(socket < 0 || size_type(socket) >= slots_.size())
+                return nullptr;
+            return slots_[socket].get();
+        }
+
+
+        tcp_connection* find(tcp_connection_id id) const noexcept {
+            auto* connection = find(id.socket);
+            if(connection == nullptr || connection->generation != id.generation)
+                return nullptr;
+            return connection;
+        }
+
+
+        tcp_connection& open(int socket, sockaddr_in const& address) {
+            if(slots_.size() <= size_type(socket))
+                slots_.resize(socket + 1);
+            auto& slot = slots_[socket];
+            if(spare_.empty()) {
+                slot = std::make_unique<tcp_connection>(socket, address);
+            } else {
+                slot = std::move(spare_.back());
+                spare_.pop_back();
+                slot->socket = socket;
+                slot->address = address;
+            }
+            slot->generation = ++generation_;
+            slot->closed = false;
+            ++size_;
+            return *slot;
+        }
+
+
+        void close(int socket) {
+            auto& slot = slots_[socket];
+            if(!slot)
+                return;
+            slot->poll_index = 0u;
+            slot->context = nullptr;
+            slot->rx.clear();
+            slot->tx.clear();
+            slot->tx_in_flight = false;
+            slot->reading_paused = false;
+            slot->read_pending = false;
+            slot->close_after_flush = false;
+            slot->tx_held = false;
+            slot->operations = 0;
+            slot->closing = false;
+            slot->receiving = false;
+            slot->shm.reset();
+            slot->shm_ready = false;
+            slot->closed = true;
+            if(releasing_) {
+                return_rx(*slot);
+                return_tx(*slot);
+            }
+            if(deferring_)
+                closed_.push_back(std::move(slot));
+            else
+                spare_.push_back(std::move(slot));
+            --size_;
+        }
+
+
+        // Closed connections keep their objects until recycled, so stale
+        // pointers to them still tell they are closed
+        void defer_recycling() noexcept {
+            deferring_ = true;
+        }
+
+
+        void recycle_closed() {
+            deferring_ = false;
+            for(auto& connection: closed_)
+                spare_.push_back(std::move(connection));
+            closed_.clear();
+        }
+
+
+        // Connections keep no buffers while idle: receive and transmit
+        // buffers are borrowed before use and returned when drained
+        void release_idle_buffers(bool enabled) noexcept {
+            releasing_ = enabled;
+        }
+
+
+        bool releasing_idle_buffers() const noexcept {
+            return releasing_;
+        }
+
+
+        void borrow_rx(tcp_connection& connection) {
+            if(connection.rx.capacity() != 0u || spare_rx_.empty())
+                return;
+            connection.rx = std::move(spare_rx_.back());
+            spare_rx_.pop_back();
+        }
+
+
+        // Buffer is kept while it holds bytes not consumed
+        void return_rx(tcp_connection& connection) {
+            if(!connection.rx.empty() || connection.rx.capacity() == 0u)
+                return;
+            connection.rx.clear();
+            if(spare_rx_.size() < spare_buffers_limit)
+                spare_rx_.push_back(std::move(connection.rx));
+            connection.rx.release();
+        }
+
+
+        void borrow_tx(tcp_connection& connection) {
+            if(connection.tx.allocated() || spare_tx_.empty())
+                return;
+            connection.tx.swap(spare_tx_.back());
+            spare_tx_.pop_back();
+        }
+
+
+        void borrow_iovecs(tcp_connection& connection) {
+            if(connection.tx_iovecs.capacity() != 0u || spare_iovecs_.empty())
+                return;
+            connection.tx_iovecs.swap(spare_iovecs_.back());
+            spare_iovecs_.pop_back();
+        }
+
+
+        // Nothing is returned while bytes are queued or in flight
+        void return_tx(tcp_connection& connection) {
+            if(!connection.tx.empty() || connection.tx_in_flight)
+                return;
+            if(connection.tx.allocated()) {
+                if(spare_tx_.size() < spare_buffers_limit)
+                    spare_tx_.emplace_back().swap(connection.tx);
+                connection.tx = tcp_output{};
+            }
+            if(connection.tx_iovecs.capacity() != 0u) {
+                connection.tx_iovecs.clear();
+                if(spare_iovecs_.size() < spare_buffers_limit)
+                    spare_iovecs_.push_back(std::move(connection.tx_iovecs));
+                connection.tx_iovecs = std::vector<iovec>{};
+            }
+        }
+
+
+        template<typename F> void for_each(F&& f) {
+            for(auto& slot: slots_)
+                if(slot)
+                    f(*slot);
+        }
+
+
+        void clear() {
+            for(auto& slot: slots_)
+                if(slot)
+                    close(slot->socket);
+        }
+
+    }; // tcp_connections
+
+} // namespace inter
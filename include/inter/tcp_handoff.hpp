@@ -0,0 +1,202 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <system_error>
+#include <vector>
+
+
+namespace inter {
+
+
+    namespace detail {
+
+        struct unix_address {
+            sockaddr_un address;
+            socklen_t size;
+
+            sockaddr const* data() const noexcept {
+                return reinterpret_cast<sockaddr const*>(&address);
+            }
+
+            bool abstract() const noexcept {
+                return address.sun_path[0] == '\0';
+            }
+        }; // unix_address
+
+
+        // Path starting with '@' is in abstract namespace, it has no file
+        // and its name is not terminated by zero
+        inline std::expected<unix_address, std::error_code>
+        make_unix_address(char const* path) noexcept {
+            auto result = unix_address{};
+            result.address.sun_family = AF_UNIX;
+            auto const length = std::strlen(path);
+            if(length == 0 || length >= sizeof(result.address.sun_path))
+                return std::unexpected(std::make_error_code(std::errc::filename_too_long));
+            std::memcpy(result.address.sun_path, path, length);
+            auto const abstract = path[0] == '@';
+            if(abstract)
+                result.address.sun_path[0] = '\0';
+            result.size = socklen_t(offsetof(sockaddr_un, sun_path) + length + (abstract ? 0 : 1));
+            return result;
+        }
+
+
+        // Socket file left by a previous listener is removed before bind,
+        // any other file at the path is kept and bind fails on it
+        inline void remove_stale_socket(char const* path) noexcept {
+            struct stat status{};
+            if(::lstat(path, &status) == 0 && S_ISSOCK(status.st_mode))
+                ::unlink(path);
+        }
+
+
+        inline std::unexpected<std::error_code> close_with_errno(int socket) noexcept {
+            auto const error = std::error_code{errno, std::system_category()};
+            ::close(socket);
+            return std::unexpected(error);
+        }
+
+
+        inline bool is_listening(int socket) noexcept {
+            auto accepting = 0;
+            auto size = socklen_t(sizeof(accepting));
+            return ::getsockopt(socket, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &size) == 0
+                && accepting != 0;
+        }
+
+    } // namespace detail
+
+
+    // Listening sockets are passed to a successor process over Unix domain
+    // socket with SCM_RIGHTS, so it accepts connections on the same sockets
+    // before the predecessor drains and exits. Every listener goes in its
+    // own message carrying the number of listeners passed in total
+
+
+    // Most listeners passed by one handoff
+    constexpr auto max_handed_off_listeners = std::uint32_t{1024};
+
+
+    // Channel the predecessor waits on for its successor, previous socket
+    // at 'path' is removed. Path starting with '@' is abstract
+    inline std::expected<int, std::error_code>
+    open_handoff_channel(char const* path) {
+        auto const address = detail::make_unix_address(path);
+        if(!address)
+            return std::unexpected(address.error());
+        auto const channel = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if(channel == -1)
+            return std::unexpected(std::error_code{errno, std::system_category()});
+        if(!address->abstract())
+            detail::remove_stale_socket(path);
+        if(::bind(channel, address->data(), address->size) == -1)
+            return detail::close_with_errno(channel);
+        if(::listen(channel, 1) == -1)
+            return detail::close_with_errno(channel);
+        return channel;
+    }
+
+
+    // Channel the successor receives listeners from
+    inline std::expected<int, std::error_code>
+    connect_handoff_channel(char const* path) {
+        auto const address = detail::make_unix_address(path);
+        if(!address)
+            return std::unexpected(address.error());
+        auto const channel = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if(channel == -1)
+            return std::unexpected(std::error_code{errno, std::system_category()});
+        if(::connect(channel, address->data(), address->size) == -1)
+            return detail::close_with_errno(channel);
+        return channel;
+    }
+
+
+    // Sends one of 'count' listeners, listener stays open in this process
+    inline std::expected<void, std::error_code>
+    send_listener(int channel, int listener, std::uint32_t count = 1) {
+        if(count == 0 || count > max_handed_off_listeners)
+            return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        auto payload = iovec{.iov_base = &count, .iov_len = sizeof(count)};
+        auto message = msghdr{};
+        message.msg_iov = &payload;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        auto* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &listener, sizeof(int));
+        for(;;) {
+            if(::sendmsg(channel, &message, MSG_NOSIGNAL) != -1)
+                return {};
+            if(errno != EINTR)
+                return std::unexpected(std::error_code{errno, std::system_category()});
+        }
+    }
+
+
+    // Receives all listeners of one handoff, they are close-on-exec and
+    // can be served with tcp_server::listen_inherited()
+    inline std::expected<std::vector<int>, std::error_code>
+    receive_listeners(int channel) {
+        auto listeners = std::vector<int>{};
+        auto const fail = [&](std::error_code error) {
+            for(auto const listener: listeners)
+                ::close(listener);
+            return std::unexpected(error);
+        };
+        auto count = std::uint32_t{1};
+        while(listeners.size() != count) {
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+            auto received_count = std::uint32_t{0};
+            auto payload = iovec{.iov_base = &received_count, .iov_len = sizeof(received_count)};
+            auto message = msghdr{};
+            message.msg_iov = &payload;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            auto const received = ::recvmsg(channel, &message, MSG_CMSG_CLOEXEC);
+            if(received == -1 && errno == EINTR)
+                continue;
+            if(received == -1)
+                return fail(std::error_code{errno, std::system_category()});
+            if(received == 0)
+                return fail(std::make_error_code(std::errc::connection_reset));
+            auto* header = CMSG_FIRSTHDR(&message);
+            if(header == nullptr || header->cmsg_level != SOL_SOCKET
+               || header->cmsg_type != SCM_RIGHTS
+               || header->cmsg_len != CMSG_LEN(sizeof(int)))
+                return fail(std::make_error_code(std::errc::bad_message));
+            auto listener = -1;
+            std::memcpy(&listener, CMSG_DATA(header), sizeof(int));
+            listeners.push_back(listener);
+            if(std::size_t(received) != sizeof(received_count)
+               || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0
+               || received_count == 0 || received_count > max_handed_off_listeners
+               || (listeners.size() != 1 && received_count != count)
+               || !detail::is_listening(listener))
+                return fail(std::make_error_code(std::errc::bad_message));
+            count = received_count;
+        }
+        return listeners;
+    }
+
+} // namespace inter
@@ -0,0 +1,502 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <memory>
+#include <span>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <variant>
+
+
+namespace inter {
+
+
+    // Immutable bytes shared by several outputs, e.g. cached response body
+    using tcp_shared_bytes = std::shared_ptr<std::string const>;
+
+
+    // File opened for sending, descriptor is closed with the last reference
+    class tcp_file {
+        int descriptor_;
+        std::uint64_t size_;
+
+    public:
+
+        tcp_file(int descriptor, std::uint64_t size) noexcept
+            : descriptor_{descriptor}, size_{size} {
+        }
+
+        tcp_file(tcp_file const&) = delete;
+        tcp_file& operator = (tcp_file const&) = delete;
+        ~tcp_file() { ::close(descriptor_); }
+
+
+        static std::expected<std::shared_ptr<tcp_file const>, std::error_code>
+        open(char const* path) {
+            auto const descriptor = ::open(path, O_RDONLY | O_CLOEXEC);
+            if(descriptor == -1)
+                return std::unexpected(std::error_code{errno, std::system_category()});
+            struct stat status;
+            if(::fstat(descriptor, &status) == -1) {
+                auto const error = std::error_code{errno, std::system_category()};
+                ::close(descriptor);
+                return std::unexpected(error);
+            }
+            return std::make_shared<tcp_file const>(descriptor, std::uint64_t(status.st_size));
+        }
+
+
+        int descriptor() const noexcept {
+            return descriptor_;
+        }
+
+
+        std::uint64_t size() const noexcept {
+            return size_;
+        }
+
+    }; // tcp_file
+
+    using tcp_file_ptr = std::shared_ptr<tcp_file const>;
+
+
+    // Part of a file sent with sendfile() straight from the page cache
+    struct tcp_file_range {
+        tcp_file_ptr file;
+        std::uint64_t offset;
+        std::size_t size;
+    }; // tcp_file_range
+
+
+    namespace detail {
+
+        // sendfile() has no MSG_NOSIGNAL, so SIGPIPE is blocked for the
+        // calling thread meanwhile and the one raised is discarded when the
+        // outermost guard is gone. It is raised even if some bytes are sent
+        // before connection is broken. Reactor thread holds a guard while
+        // serving, so files sent there cost no signal mask changes
+        class sigpipe_guard {
+            static inline thread_local unsigned depth_{0u};
+            static inline thread_local bool raised_{false};
+            static inline thread_local sigset_t previous_;
+
+            static sigset_t sigpipe_set() noexcept {
+                auto set = sigset_t{};
+                ::sigemptyset(&set);
+                ::sigaddset(&set, SIGPIPE);
+                return set;
+            }
+
+        public:
+
+            sigpipe_guard() noexcept {
+                if(depth_++ != 0u)
+                    return;
+                raised_ = false;
+                auto const blocked = sigpipe_set();
+                ::pthread_sigmask(SIG_BLOCK, &blocked, &previous_);
+            }
+
+            sigpipe_guard(sigpipe_guard const&) = delete;
+            sigpipe_guard& operator = (sigpipe_guard const&) = delete;
+
+            ~sigpipe_guard() {
+                if(--depth_ != 0u)
+                    return;
+                // Signal blocked by somebody else is not ours to discard
+                if(raised_ && !::sigismember(&previous_, SIGPIPE)) {
+                    auto const blocked = sigpipe_set();
+                    auto const no_wait = timespec{};
+                    (void)::sigtimedwait(&blocked, nullptr, &no_wait);
+                }
+                ::pthread_sigmask(SIG_SETMASK, &previous_, nullptr);
+            }
+
+
+            // Broken connection might have raised the signal
+            void raised() noexcept {
+                raised_ = true;
+            }
+
+        }; // sigpipe_guard
+
+    } // namespace detail
+
+
+    // Chain of segments sent in order with one sendmsg() per IOV_MAX
+    // segments, so head and body of a response go out without being
+    // copied into one buffer; file ranges go with sendfile(). Segment
+    // bytes keep their addresses until they are consumed, even if more
+    // segments are appended
+    class tcp_output {
+        // Owned, borrowed (should outlive the output), shared bytes or file
+        using segment = std::variant<std::string,
+                                     std::span<char const>,
+                                     tcp_shared_bytes,
+                                     tcp_file_range>;
+
+        struct segment_view {
+            std::span<char const> operator () (std::string const& owned) const noexcept {
+                return {owned.data(), owned.size()};
+            }
+
+            std::span<char const> operator () (std::span<char const> borrowed) const noexcept {
+                return borrowed;
+            }
+
+            std::span<char const> operator () (tcp_shared_bytes const& shared) const noexcept {
+                return {shared->data(), shared->size()};
+            }
+
+            std::span<char const> operator () (tcp_file_range const&) const noexcept {
+                return {};
+            }
+        }; // segment_view
+
+
+        static std::size_t segment_size(segment const& s) noexcept {
+            if(auto const* range = std::get_if<tcp_file_range>(&s))
+                return range->size;
+            return std::visit(segment_view{}, s).size();
+        }
+
+        // Allocated by the first segment appended
+        std::unique_ptr<std::deque<segment>> segments_;
+        // Bytes of the first segment sent already
+        std::size_t offset_{0u};
+        // Bytes not sent yet
+        std::size_t size_{0u};
+
+    public:
+
+        using size_type = std::size_t;
+
+        static constexpr auto gather_limit = size_type{IOV_MAX};
+        // Copied bytes are coalesced into blocks at least of this size
+        static constexpr auto copy_block_size = size_type{4096};
+
+        tcp_output() = default;
+        tcp_output(tcp_output const&) = delete;
+        tcp_output& operator = (tcp_output const&) = delete;
+        tcp_output(tcp_output&&) = default;
+        tcp_output& operator = (tcp_output&&) = default;
+
+
+        size_type size() const noexcept {
+            return size_;
+        }
+
+
+        bool empty() const noexcept {
+            return size_ == 0u;
+        }
+
+
+        size_type segments_count() const noexcept {
+            return segments_ ? segments_->size() : 0u;
+        }
+
+
+        // Output holds memory even when empty once anything was appended
+        bool allocated() const noexcept {
+            return segments_ != nullptr;
+        }
+
+
+        void append(std::string owned) {
+            if(owned.empty())
+                return;
+            size_ += owned.size();
+            segments().emplace_back(std::move(owned));
+        }
+
+
+        // Bytes are not copied and should stay valid until they are sent
+        void borrow(std::span<char const> borrowed) {
+            if(borrowed.empty())
+                return;
+            size_ += borrowed.size();
+            segments().emplace_back(borrowed);
+        }
+
+
+        void share(tcp_shared_bytes shared) {
+            if(!shared || shared->empty())
+                return;
+            size_ += shared->size();
+            segments().emplace_back(std::move(shared));
+        }
+
+
+        // File bytes are read when they are sent, so the range should
+        // stay unchanged until then
+        void append(tcp_file_range range) {
+            if(!range.file || range.size == 0u)
+                return;
+            size_ += range.size;
+            segments().emplace_back(std::move(range));
+        }
+
+
+        // Appends copy of bytes to the last owned segment if it has room,
+        // so the bytes already gathered for sending never move
+        void copy(std::span<char const> data) {
+            if(data.empty())
+                return;
+            size_ += data.size();
+            if(segments_ && !segments_->empty())
+                if(auto* last = std::get_if<std::string>(&segments_->back());
+                   last != nullptr && last->capacity() - last->size() >= data.size()) {
+                    last->append(data.data(), data.size());
+                    return;
+                }
+            auto owned = std::string{};
+            owned.reserve(std::max(data.size(), copy_block_size));
+            owned.append(data.data(), data.size());
+            segments().emplace_back(std::move(owned));
+        }
+
+
+        // Moves all segments of 'other' to the end of this output
+        void append(tcp_output&& other) {
+            if(other.empty())
+                return;
+            if(empty()) {
+                swap(other);
+                return;
+            }
+            auto first = other.segments_->begin();
+            if(other.offset_ != 0u) {
+                if(auto* range = std::get_if<tcp_file_range>(&*first))
+                    append(tcp_file_range{
+                        .file = std::move(range->file),
+                        .offset = range->offset + other.offset_,
+                        .size = range->size - other.offset_
+                    });
+                else
+                    copy(std::visit(segment_view{}, *first).subspan(other.offset_));
+                ++first;
+            }
+            for(; first != other.segments_->end(); ++first) {
+                size_ += segment_size(*first);
+                segments_->emplace_back(std::move(*first));
+            }
+            other.clear();
+        }
+
+
+        // File range not sent yet goes first
+        tcp_file_range const* front_file() const noexcept {
+            if(!segments_ || segments_->empty())
+                return nullptr;
+            return std::get_if<tcp_file_range>(&segments_->front());
+        }
+
+
+        // Fills 'iovecs' with bytes not sent yet up to the next file range,
+        // returns number of filled
+        size_type gather(std::span<iovec> iovecs) const noexcept {
+            auto count = size_type{0};
+            if(!segments_)
+                return 0u;
+            auto offset = offset_;
+            for(auto const& s: *segments_) {
+                if(count == iovecs.size() || std::holds_alternative<tcp_file_range>(s))
+                    break;
+                auto const bytes = std::visit(segment_view{}, s);
+                iovecs[count++] = iovec{
+                    .iov_base = const_cast<char*>(bytes.data() + offset),
+                    .iov_len = bytes.size() - offset
+                };
+                offset = 0u;
+            }
+            return count;
+        }
+
+
+        // Drops 'count' sent bytes from the front
+        void consume(size_type count) noexcept {
+            size_ -= count;
+            while(count != 0u) {
+                auto const left = segment_size(segments_->front()) - offset_;
+                if(count < left) {
+                    offset_ += count;
+                    return;
+                }
+                count -= left;
+                segments_->pop_front();
+                offset_ = 0u;
+            }
+        }
+
+
+        void clear() noexcept {
+            if(segments_)
+                segments_->clear();
+            offset_ = 0u;
+            size_ = 0u;
+        }
+
+
+        void swap(tcp_output& other) noexcept {
+            segments_.swap(other.segments_);
+            std::swap(offset_, other.offset_);
+            std::swap(size_, other.size_);
+        }
+
+
+        // Writes to non-blocking socket until it is full or output is
+        // empty, bytes are gathered into 'iovecs' holding at least one.
+        // Returns number of bytes written
+        std::expected<size_type, std::error_code>
+        write_to(int socket, std::span<iovec> iovecs) {
+            auto const initial_size = size_;
+            while(!empty()) {
+                auto const sent = front_file() != nullptr
+                    ? send_file(socket)
+                    : send_bytes(socket, iovecs);
+                if(!sent)
+                    return std::unexpected(sent.error());
+                if(!*sent)
+                    break;
+            }
+            return initial_size - size_;
+        }
+
+
+        // Same as above with iovecs of the calling thread
+        std::expected<size_type, std::error_code> write_to(int socket) {
+            static thread_local auto iovecs = std::array<iovec, gather_limit>{};
+            return write_to(socket, iovecs);
+        }
+
+
+        // Passes bytes not sent yet to 'sink' until it takes fewer of them
+        // than given, file ranges are read in blocks. Sink returns number of
+        // bytes taken, they are dropped. Returns number of bytes taken
+        template<typename F>
+        std::expected<size_type, std::error_code> copy_to(F&& sink) {
+            // Filled by file ranges only
+            std::array<char, copy_block_size> block;
+            auto const initial_size = size_;
+            while(!empty()) {
+                auto bytes = std::span<char const>{};
+                if(auto const* range = front_file(); range != nullptr) {
+                    auto const result = ::pread(range->file->descriptor(), block.data(),
+                                                std::min(range->size - offset_, block.size()),
+                                                off_t(range->offset + offset_));
+                    if(result == -1 && errno == EINTR)
+                        continue;
+                    if(result == -1)
+                        return std::unexpected(std::error_code{errno, std::system_category()});
+                    if(result == 0)
+                        // File is shorter than the range
+                        return std::unexpected(std::make_error_code(std::errc::io_error));
+                    bytes = {block.data(), size_type(result)};
+                } else {
+                    bytes = std::visit(segment_view{}, segments_->front()).subspan(offset_);
+                }
+                auto const taken = sink(bytes);
+                consume(taken);
+                if(taken < bytes.size())
+                    break;
+            }
+            return initial_size - size_;
+        }
+
+
+        // Sends the first file range with sendfile(), returns false if
+        // socket is full
+        std::expected<bool, std::error_code> send_file(int socket) {
+            auto const& range = *front_file();
+            auto guard = detail::sigpipe_guard{};
+            for(;;) {
+                auto position = off_t(range.offset + offset_);
+                auto const left = range.size - offset_;
+                auto const result = ::sendfile(socket, range.file->descriptor(),
+                                               &position, left);
+                if(result > 0) {
+                    consume(size_type(result));
+                    if(size_type(result) == left)
+                        return true;
+                    // Broken connection can cut sending short
+                    guard.raised();
+                    return false;
+                }
+                if(result == 0)
+                    // File is shorter than the range
+                    return std::unexpected(std::make_error_code(std::errc::io_error));
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN)
+                    return false;
+                auto const error = std::error_code{errno, std::system_category()};
+                if(error.value() == EPIPE)
+                    guard.raised();
+                return std::unexpected(error);
+            }
+        }
+
+    private:
+
+        std::deque<segment>& segments() {
+            if(!segments_)
+                segments_ = std::make_unique<std::deque<segment>>();
+            return *segments_;
+        }
+
+
+        // Sends bytes up to the next file range, returns false if socket
+        // is full
+        std::expected<bool, std::error_code>
+        send_bytes(int socket, std::span<iovec> iovecs) {
+            auto message = msghdr{};
+            message.msg_iov = iovecs.data();
+            message.msg_iovlen = gather(iovecs);
+            auto requested = size_type{0};
+            for(auto i = size_type{0}; i != message.msg_iovlen; ++i)
+                requested += iovecs[i].iov_len;
+            // File range follows, let the kernel put them into one packet
+            auto const more = message.msg_iovlen < iovecs.size() && requested < size_;
+            for(;;) {
+                auto const result = ::sendmsg(socket, &message,
+                                              MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+                if(result == -1) {
+                    if(errno == EINTR)
+                        continue;
+                    if(errno == EAGAIN)
+                        return false;
+                    return std::unexpected(std::error_code{errno, std::system_category()});
+                }
+                consume(size_type(result));
+                // Short write means socket is full
+                return size_type(result) == requested;
+            }
+        }
+
+    }; // tcp_output
+
+} // namespace inter
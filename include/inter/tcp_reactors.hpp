@@ -0,0 +1,235 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <future>
+#include <memory>
+#include <span>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <inter/tcp_server.hpp>
+
+
+namespace inter {
+
+
+    // Runs several tcp_server's on their own threads. Every reactor has its
+    // own listening socket on the same port (SO_REUSEPORT), its own
+    // descriptors and its own observer, so nothing is shared between them
+    class tcp_reactors {
+    public:
+
+        using size_type = std::size_t;
+        using observer_ptr = std::unique_ptr<tcp_server_observer>;
+        using observer_factory = std::function<observer_ptr(size_type reactor)>;
+
+        static constexpr auto default_export_timeout = std::chrono::milliseconds{5000};
+
+    private:
+
+        struct reactor {
+            tcp_server server;
+            observer_ptr observer;
+            std::expected<void, std::error_code> result;
+            std::thread thread;
+
+            explicit reactor(tcp_server_options const& options): server{options} { }
+        }; // reactor
+
+        tcp_server_options options_{.engine = tcp_engine::epoll};
+        std::vector<std::unique_ptr<reactor>> reactors_;
+
+    public:
+
+        tcp_reactors() = default;
+        explicit tcp_reactors(tcp_engine engine) noexcept: options_{.engine = engine} { }
+        explicit tcp_reactors(tcp_server_options const& options) noexcept: options_{options} { }
+        tcp_reactors(tcp_reactors const&) = delete;
+        tcp_reactors& operator = (tcp_reactors const&) = delete;
+        tcp_reactors(tcp_reactors&&) = delete;
+        tcp_reactors& operator = (tcp_reactors&&) = delete;
+        ~tcp_reactors() { stop(); join(); }
+
+
+        size_type size() const noexcept {
+            return reactors_.size();
+        }
+
+
+        tcp_server& server(size_type index) noexcept {
+            return reactors_[index]->server;
+        }
+
+
+        tcp_server_observer& observer(size_type index) noexcept {
+            return *reactors_[index]->observer;
+        }
+
+
+        // Opens all listening sockets on the calling thread and starts
+        // 'count' reactor threads serving them
+        std::expected<void, std::error_code>
+        start(std::int16_t port,
+              size_type count,
+              observer_factory const& make_observer,
+              int connection_requests_limit = tcp_server::default_connection_requests_limit) {
+            if(!reactors_.empty())
+                return std::unexpected(std::make_error_code(std::errc::operation_in_progress));
+            auto server_sockets = std::vector<int>{};
+            server_sockets.reserve(count);
+            for(auto i = size_type{0}; i != count; ++i) {
+                auto const server_socket = tcp_server::open_listener(port, options_.socket,
+                                                                     connection_requests_limit);
+                if(!server_socket) {
+                    for(auto const opened: server_sockets)
+                        ::close(opened);
+                    return std::unexpected(server_socket.error());
+                }
+                server_sockets.push_back(*server_socket);
+            }
+            start_threads(count, make_observer, server_sockets);
+            return {};
+        }
+
+
+        // Starts reactor thread per listening socket received from
+        // a predecessor process with receive_listeners()
+        std::expected<void, std::error_code>
+        start_inherited(std::span<int const> server_sockets,
+                        observer_factory const& make_observer) {
+            auto const valid = std::ranges::all_of(server_sockets, [](int server_socket) {
+                return detail::is_listening(server_socket);
+            });
+            if(!reactors_.empty() || !valid) {
+                for(auto const server_socket: server_sockets)
+                    ::close(server_socket);
+                return std::unexpected(std::make_error_code(reactors_.empty()
+                    ? std::errc::invalid_argument
+                    : std::errc::operation_in_progress));
+            }
+            start_threads(server_sockets.size(), make_observer,
+                          {server_sockets.begin(), server_sockets.end()});
+            return {};
+        }
+
+
+        // Starts 'count' reactor threads without listening sockets, they
+        // serve connections passed by tcp_server::adopt() only
+        std::expected<void, std::error_code>
+        start(size_type count, observer_factory const& make_observer) {
+            if(!reactors_.empty())
+                return std::unexpected(std::make_error_code(std::errc::operation_in_progress));
+            start_threads(count, make_observer, std::vector<int>(count, -1));
+            return {};
+        }
+
+
+        void stop() noexcept {
+            for(auto& r: reactors_)
+                r->server.stop();
+        }
+
+
+        // Sends listening sockets of all reactors to a successor process,
+        // they are served here as well until reactors are drained or
+        // stopped. Waits for every reactor 'timeout' at most, reactor not
+        // serving is operation_canceled error
+        std::expected<void, std::error_code>
+        export_listeners(int channel,
+                         std::chrono::milliseconds timeout = default_export_timeout) {
+            using exported_result = std::expected<void, std::error_code>;
+            auto const count = std::uint32_t(reactors_.size());
+            auto results = std::vector<std::future<exported_result>>{};
+            results.reserve(reactors_.size());
+            auto result = exported_result{};
+            for(auto& r: reactors_) {
+                auto exported = std::promise<exported_result>{};
+                auto future = exported.get_future();
+                auto& server = r->server;
+                auto const posted = server.post([&server, channel, count,
+                                                 exported = std::move(exported)] mutable {
+                    exported.set_value(server.export_listener(channel, count));
+                });
+                if(posted)
+                    results.push_back(std::move(future));
+                else if(result)
+                    result = std::unexpected(std::make_error_code(std::errc::operation_canceled));
+            }
+            auto const deadline = std::chrono::steady_clock::now() + timeout;
+            for(auto& exported: results) {
+                auto const r = wait_exported(exported, deadline);
+                if(result && !r)
+                    result = r;
+            }
+            return result;
+        }
+
+
+        // Every reactor stops accepting and finishes its connections
+        void drain(std::chrono::milliseconds timeout) noexcept {
+            for(auto& r: reactors_)
+                r->server.drain(timeout);
+        }
+
+
+        // Waits for all reactors to finish, returns the first error if any
+        std::expected<void, std::error_code> join() {
+            auto result = std::expected<void, std::error_code>{};
+            for(auto& r: reactors_) {
+                if(r->thread.joinable())
+                    r->thread.join();
+                if(result && !r->result)
+                    result = r->result;
+            }
+            reactors_.clear();
+            return result;
+        }
+
+
+    private:
+
+        // Task dropped by reactor that stopped meanwhile is cancelled
+        static std::expected<void, std::error_code>
+        wait_exported(std::future<std::expected<void, std::error_code>>& exported,
+                      std::chrono::steady_clock::time_point deadline) {
+            if(exported.wait_until(deadline) != std::future_status::ready)
+                return std::unexpected(std::make_error_code(std::errc::timed_out));
+            try {
+                return exported.get();
+            } catch(std::future_error const&) {
+                return std::unexpected(std::make_error_code(std::errc::operation_canceled));
+            }
+        }
+
+
+        void start_threads(size_type count,
+                           observer_factory const& make_observer,
+                           std::vector<int> const& server_sockets) {
+            reactors_.reserve(count);
+            for(auto i = size_type{0}; i != count; ++i) {
+                auto options = options_;
+                if(options.cpu >= 0)
+                    options.cpu += int(i);
+                auto& r = *reactors_.emplace_back(std::make_unique<reactor>(options));
+                r.observer = make_observer(i);
+                r.thread = std::thread{[&r, server_socket = server_sockets[i]] {
+                    r.result = r.server.serve(server_socket, *r.observer);
+                }};
+            }
+        }
+
+    }; // tcp_reactors
+
+} // namespace inter
@@ -0,0 +1,297 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <new>
+#include <span>
+#include <system_error>
+#include <utility>
+
+
+namespace inter {
+
+
+    namespace detail {
+
+        // The same pages mapped twice back to back, so bytes running past
+        // the end of the first copy continue at the start of the pages
+        class mirrored_region {
+            char* data_{nullptr};
+            std::size_t size_{0u};
+
+        public:
+
+            mirrored_region() noexcept = default;
+            mirrored_region(mirrored_region const&) = delete;
+            mirrored_region& operator = (mirrored_region const&) = delete;
+
+            mirrored_region(mirrored_region&& other) noexcept
+                : data_{std::exchange(other.data_, nullptr)},
+                  size_{std::exchange(other.size_, 0u)} {
+            }
+
+            mirrored_region& operator = (mirrored_region&& other) noexcept {
+                mirrored_region{std::move(other)}.swap(*this);
+                return *this;
+            }
+
+            ~mirrored_region() {
+                if(data_ != nullptr)
+                    ::munmap(data_, 2 * size_);
+            }
+
+
+            static std::size_t page_size() noexcept {
+                static auto const size = std::size_t(::sysconf(_SC_PAGESIZE));
+                return size;
+            }
+
+
+            // 'size' is a multiple of page size
+            static std::expected<mirrored_region, std::error_code> create(std::size_t size) {
+                auto const pages = ::memfd_create("inter-rx", MFD_CLOEXEC);
+                if(pages == -1)
+                    return std::unexpected(std::error_code{errno, std::system_category()});
+                auto region = mirrored_region{};
+                auto const mapped = ::ftruncate(pages, off_t(size)) != -1
+                                 && region.map(pages, size);
+                auto const error = std::error_code{errno, std::system_category()};
+                // Mappings keep the pages
+                ::close(pages);
+                if(!mapped)
+                    return std::unexpected(error);
+                return region;
+            }
+
+
+            char* data() const noexcept {
+                return data_;
+            }
+
+
+            std::size_t size() const noexcept {
+                return size_;
+            }
+
+
+            void swap(mirrored_region& other) noexcept {
+                std::swap(data_, other.data_);
+                std::swap(size_, other.size_);
+            }
+
+        private:
+
+            bool map(int pages, std::size_t size) noexcept {
+                // Address range for both copies is reserved first, so
+                // nothing else is mapped between them
+                auto* const reserved = ::mmap(nullptr, 2 * size, PROT_NONE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(reserved == MAP_FAILED)
+                    return false;
+                data_ = static_cast<char*>(reserved);
+                size_ = size;
+                for(auto* const copy: {data_, data_ + size})
+                    if(::mmap(copy, size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_FIXED, pages, 0) == MAP_FAILED)
+                        return false;
+                return true;
+            }
+
+        }; // mirrored_region
+
+    } // namespace detail
+
+
+    // Bytes received from connection and not consumed by observer yet, kept
+    // in a ring mapped twice in a row. Unconsumed bytes and free space are
+    // contiguous even when they wrap past the end of the ring, so bytes are
+    // never moved unless the ring grows. Every ring takes two mappings out
+    // of vm.max_map_count (65530 by default), so about 32k rings fit in a
+    // process. Buffer whose ring can not be mapped keeps bytes in plain
+    // memory instead and moves them to its start to make space, such
+    // fallbacks are counted by unmapped_rings()
+    class tcp_rx_buffer {
+        static inline std::atomic<std::size_t> unmapped_rings_{0u};
+
+        detail::mirrored_region ring_;
+        std::unique_ptr<char[]> flat_;
+        std::size_t flat_capacity_{0u};
+        // Bytes consumed and received since the buffer was cleared
+        std::uint64_t consumed_{0u};
+        std::uint64_t received_{0u};
+
+    public:
+
+        using size_type = std::size_t;
+
+        static constexpr auto initial_capacity = size_type{4096};
+        // Space is made for so many bytes at least before reading
+        static constexpr auto min_read_size = size_type{1024};
+
+        tcp_rx_buffer() = default;
+        tcp_rx_buffer(tcp_rx_buffer const&) = delete;
+        tcp_rx_buffer& operator = (tcp_rx_buffer const&) = delete;
+        tcp_rx_buffer(tcp_rx_buffer&&) = default;
+        tcp_rx_buffer& operator = (tcp_rx_buffer&&) = default;
+
+
+        // Times a ring could not be mapped in this process and plain memory
+        // was taken instead, e.g. since vm.max_map_count is reached
+        static size_type unmapped_rings() noexcept {
+            return unmapped_rings_.load(std::memory_order_relaxed);
+        }
+
+
+        size_type size() const noexcept {
+            return size_type(received_ - consumed_);
+        }
+
+
+        bool empty() const noexcept {
+            return received_ == consumed_;
+        }
+
+
+        size_type capacity() const noexcept {
+            return flat_ ? flat_capacity_ : ring_.size();
+        }
+
+
+        // Bytes are kept in the ring, not in plain memory
+        bool mirrored() const noexcept {
+            return !flat_;
+        }
+
+
+        std::span<char const> data() const noexcept {
+            return {begin() + offset(consumed_), size()};
+        }
+
+
+        void consume(size_type count) noexcept {
+            consumed_ += std::min(count, size());
+        }
+
+
+        // Free space for at least 'count' bytes if 'limit' allows, it is
+        // empty if there is no space at all. Buffer grows into plain memory
+        // unless 'mirrored'
+        std::span<char> prepare(size_type count, size_type limit, bool mirrored = true) {
+            if(capacity() - size() < count && capacity() < limit)
+                grow(size() + count, limit, mirrored);
+            if(flat_ && capacity() - received_ < count)
+                compact();
+            auto const space = flat_ ? capacity() - received_ : capacity() - size();
+            return {begin() + offset(received_), space};
+        }
+
+
+        // Bytes written to the space given by prepare()
+        void commit(size_type count) noexcept {
+            received_ += count;
+        }
+
+
+        // Reads once into free space, returns 0 if peer has closed
+        // connection and no_buffer_space error if 'limit' is reached
+        std::expected<size_type, std::error_code>
+        read_from(int socket, size_type limit, bool mirrored = true) {
+            auto const space = prepare(min_read_size, limit, mirrored);
+            if(space.empty())
+                return std::unexpected(std::make_error_code(std::errc::no_buffer_space));
+            for(;;) {
+                auto const result = ::read(socket, space.data(), space.size());
+                if(result >= 0) {
+                    commit(size_type(result));
+                    return size_type(result);
+                }
+                if(errno != EINTR)
+                    return std::unexpected(std::error_code{errno, std::system_category()});
+            }
+        }
+
+
+        // Memory is kept for the next connection
+        void clear() noexcept {
+            consumed_ = received_ = 0u;
+        }
+
+
+        void release() noexcept {
+            ring_ = detail::mirrored_region{};
+            flat_.reset();
+            flat_capacity_ = 0u;
+            clear();
+        }
+
+    private:
+
+        char* begin() const noexcept {
+            return flat_ ? flat_.get() : ring_.data();
+        }
+
+
+        size_type offset(std::uint64_t position) const noexcept {
+            if(flat_)
+                return size_type(position);
+            // Capacity is a power of two
+            return capacity() == 0u ? 0u : size_type(position & (capacity() - 1));
+        }
+
+
+        void compact() noexcept {
+            auto const bytes = data();
+            if(!bytes.empty() && consumed_ != 0u)
+                std::memmove(flat_.get(), bytes.data(), bytes.size());
+            consumed_ = 0u;
+            received_ = bytes.size();
+        }
+
+
+        // Buffer stays as is if memory can not be had at all
+        void grow(size_type required, size_type limit, bool mirrored) {
+            auto const wanted = std::max({capacity() * 2, required, initial_capacity});
+            auto const capacity = std::bit_ceil(std::max(std::min(wanted, limit),
+                                                         detail::mirrored_region::page_size()));
+            auto const bytes = data();
+            if(!flat_ && mirrored) {
+                if(auto ring = detail::mirrored_region::create(capacity); ring) {
+                    if(!bytes.empty())
+                        std::memcpy(ring->data(), bytes.data(), bytes.size());
+                    ring_ = std::move(*ring);
+                    consumed_ = 0u;
+                    received_ = bytes.size();
+                    return;
+                }
+                unmapped_rings_.fetch_add(1u, std::memory_order_relaxed);
+            }
+            auto flat = std::unique_ptr<char[]>{new(std::nothrow) char[capacity]};
+            if(!flat)
+                return;
+            if(!bytes.empty())
+                std::memcpy(flat.get(), bytes.data(), bytes.size());
+            ring_ = detail::mirrored_region{};
+            flat_ = std::move(flat);
+            flat_capacity_ = capacity;
+            consumed_ = 0u;
+            received_ = bytes.size();
+        }
+
+    }; // tcp_rx_buffer
+
+} // namespace inter
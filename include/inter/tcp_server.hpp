@@ -7,18 +7,39 @@
 
 #include <errno.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <expected>
 #include <functional>
+#include <optional>
 #include <span>
+#include <string>
 #include <system_error>
 #include <vector>
 
+#include <inter/bounded_queue.hpp>
+#include <inter/io_ring.hpp>
+#include <inter/shm_channel.hpp>
+#include <inter/tcp_connection.hpp>
+#include <inter/tcp_handoff.hpp>
+#include <inter/tcp_output.hpp>
+#include <inter/timer_wheel.hpp>
+
 
 namespace inter {
 
@@ -29,24 +50,77 @@ namespace inter {
             return std::unexpected(std::error_code{errno, std::system_category()});
         }
 
-    } // namespace detail
 
+        inline bool make_nonblocking(int socket) noexcept {
+            auto const flags = ::fcntl(socket, F_GETFL, 0);
+            if(flags == -1)
+                return false;
+            return ::fcntl(socket, F_SETFL, flags | O_NONBLOCK) != -1;
+        }
 
-    class tcp_rx_buffer {
-        std::vector<char> buffer_;
-        std::size_t received_{0u};
 
-    public:
+        inline int open_spare_descriptor() noexcept {
+            return ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+
 
-        tcp_rx_buffer() = default;
-        tcp_rx_buffer(tcp_rx_buffer const&) = delete;
-        tcp_rx_buffer& operator = (tcp_rx_buffer const&) = delete;
-        tcp_rx_buffer(tcp_rx_buffer&&) = default;
-        tcp_rx_buffer& operator = (tcp_rx_buffer&&) = default;
-        void clear() { buffer_.clear(); received_ = 0u; }
+        // When process is out of descriptors pending connection can not be
+        // accepted and listening socket stays readable forever, so spare
+        // descriptor is released to accept and drop that connection
+        inline bool drop_pending(int server_socket, int& spare_fd) noexcept {
+            if(spare_fd == -1)
+                return false;
+            ::close(spare_fd);
+            auto const dropped = ::accept(server_socket, nullptr, nullptr);
+            if(dropped != -1)
+                ::close(dropped);
+            spare_fd = open_spare_descriptor();
+            return dropped != -1;
+        }
 
-    }; // tcp_rx_buffer
 
+        // Address of Unix domain peer does not fit sockaddr_in, so only its
+        // family is kept
+        inline void clear_unix_peer(sockaddr_in& address) noexcept {
+            if(address.sin_family == AF_UNIX) {
+                address = sockaddr_in{};
+                address.sin_family = AF_UNIX;
+            }
+        }
+
+
+        // Accepts up to 'limit' pending connections from non-blocking
+        // listening socket, accepted sockets are non-blocking too
+        template<typename F> void
+        accept_pending(int server_socket, int& spare_fd, std::size_t limit, F&& accepted) {
+            for(auto i = std::size_t{0}; i != limit; ++i) {
+                auto client_addr = sockaddr_in{};
+                auto client_addr_size = socklen_t(sizeof(client_addr));
+                auto const client_socket = ::accept4(server_socket,
+                                                     reinterpret_cast<sockaddr*>(&client_addr),
+                                                     &client_addr_size,
+                                                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if(client_socket != -1) {
+                    clear_unix_peer(client_addr);
+                    accepted(client_socket, client_addr);
+                    continue;
+                }
+                switch(errno) {
+                    case EINTR:
+                    case ECONNABORTED:
+                        continue;
+                    case EMFILE:
+                    case ENFILE:
+                        if(drop_pending(server_socket, spare_fd))
+                            continue;
+                        return;
+                    default:
+                        return;
+                }
+            }
+        }
+
+    } // namespace detail
 
 
 
@@ -55,38 +129,481 @@ namespace inter {
     }; // tcp_response
 
 
+    // Sockets are non-blocking with every engine
+    // poll:     level-triggered, cost of each wakeup grows with connections count
+    // epoll:    edge-triggered, cost of each wakeup grows with ready connections
+    //           count only; observer should read socket until EAGAIN
+    //           in on_data_ready
+    // io_uring: multishot accept and multishot poll, sends are submitted
+    //           in batch with the next wait; same contract for
+    //           on_data_ready as for epoll. tcp_data_observer connections
+    //           receive with multishot recv into buffers of the reactor,
+    //           so bytes come with completions without reads
+    enum class tcp_engine {
+        poll, epoll, io_uring
+    }; // tcp_engine
+
+
+    // Zero leaves system default for every option but no_delay
+    struct tcp_socket_options {
+        // IPv4 address listening socket is bound to
+        std::string bind_address{"0.0.0.0"};
+        // Responses go out with one gather write, so Nagle's algorithm
+        // only delays them until the peer's delayed ACK
+        bool no_delay{true};
+        // Connection is accepted when its first bytes arrive, or as usual
+        // after so long
+        std::chrono::seconds defer_accept{0};
+        // Pending TCP Fast Open requests of listening socket
+        int fastopen_queue{0};
+        // Set on listening socket before listen(), so window scaling of
+        // accepted sockets fits them
+        int receive_buffer{0};
+        int send_buffer{0};
+        // Socket is reported writable when unsent bytes are fewer
+        int not_sent_low_watermark{0};
+        // Socket is reported readable when so many bytes are received
+        int receive_low_watermark{0};
+        // ACK is sent right away, kernel clears it so it is set again
+        // after every on_data_ready()
+        bool quick_ack{false};
+    }; // tcp_socket_options
+
+
+    struct tcp_server_options {
+        tcp_engine engine{tcp_engine::poll};
+        tcp_socket_options socket{};
+        // Connections waiting in adopt() queue
+        std::size_t handoffs_limit{1024};
+        // Tasks waiting in post() queue
+        std::size_t tasks_limit{1024};
+        // Connections accepted at most per one wakeup of listening socket
+        std::size_t accept_batch{64};
+        // Reading from connection stops when more bytes than high watermark
+        // are queued for sending and resumes below low watermark
+        std::size_t tx_high_watermark{1024 * 1024};
+        std::size_t tx_low_watermark{256 * 1024};
+        // Bytes tcp_data_observer has not consumed yet, connection is
+        // closed if they reach the limit and observer consumes none
+        std::size_t rx_buffer_limit{1024 * 1024};
+        // Receive buffers are rings mapped twice, so bytes are never moved.
+        // Every ring takes two of vm.max_map_count mappings (65530 by
+        // default), so rings of about 32k connections fit in a process and
+        // buffers of the rest fall back to plain memory, counted by
+        // tcp_rx_buffer::unmapped_rings(). False keeps them all in plain
+        // memory and takes no mappings
+        bool mirrored_rx_buffers{true};
+        // Idle connection owns no buffers: they are borrowed from the
+        // reactor's spare ones when bytes arrive or are queued for sending
+        // and returned as soon as they are drained. Saves memory with many
+        // idle connections for a few more instructions per event
+        bool release_idle_buffers{false};
+        // Connection is closed if its queued bytes are not sent for so
+        // long, zero disables the timeout
+        std::chrono::milliseconds write_timeout{60000};
+        // Precision of timeouts
+        std::chrono::milliseconds timer_resolution{10};
+        // Reactor spins on waits without timeout instead of sleeping, for
+        // isolated cores where latency matters more than CPU usage
+        bool busy_poll{false};
+        // SO_BUSY_POLL of listening socket, inherited by accepted ones:
+        // kernel polls device queue so long before socket is reported
+        // empty. Zero leaves system default
+        std::chrono::microseconds socket_busy_poll{0};
+        // SO_PREFER_BUSY_POLL of listening socket, device interrupts are
+        // deferred while application keeps polling
+        bool prefer_busy_poll{false};
+        // io_uring engine: buffers tcp_data_observer connections receive
+        // into, shared by all connections of the reactor (up to 65536).
+        // Bytes are passed to observer right from them. Zero buffers polls
+        // connections and reads them instead
+        std::size_t ring_receive_buffers{256};
+        std::size_t ring_receive_buffer_size{16 * 1024};
+        // CPU reactor thread is pinned to by serve(), -1 leaves it as is.
+        // tcp_reactors pins reactor 'i' to 'cpu + i'
+        int cpu{-1};
+    }; // tcp_server_options
+
+
+    namespace detail {
+
+        inline std::expected<void, std::error_code>
+        set_busy_poll(int socket, tcp_server_options const& options) noexcept {
+            if(options.socket_busy_poll.count() > 0) {
+                auto const usecs = int(options.socket_busy_poll.count());
+                if(::setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) == -1)
+                    return make_unexpected_from_errno();
+            }
+            if(options.prefer_busy_poll) {
+                auto const prefer = 1;
+                if(::setsockopt(socket, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+                                &prefer, sizeof(prefer)) == -1)
+                    return make_unexpected_from_errno();
+            }
+            return {};
+        }
+
+
+        inline bool set_option(int socket, int level, int name, int value) noexcept {
+            return ::setsockopt(socket, level, name, &value, sizeof(value)) != -1;
+        }
+
+
+        // Options of accepted socket, listening socket's ones are not
+        // inherited by connections adopted from other listeners
+        inline bool set_connection_options(int socket, tcp_socket_options const& options) noexcept {
+            return (!options.no_delay || set_option(socket, IPPROTO_TCP, TCP_NODELAY, 1))
+                && (options.not_sent_low_watermark == 0
+                    || set_option(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                                  options.not_sent_low_watermark))
+                && (options.receive_low_watermark == 0
+                    || set_option(socket, SOL_SOCKET, SO_RCVLOWAT,
+                                  options.receive_low_watermark))
+                && (!options.quick_ack || set_option(socket, IPPROTO_TCP, TCP_QUICKACK, 1));
+        }
+
+
+        inline bool set_listener_options(int socket, tcp_socket_options const& options) noexcept {
+            return (options.defer_accept.count() == 0
+                    || set_option(socket, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                                  int(options.defer_accept.count())))
+                && (options.fastopen_queue == 0
+                    || set_option(socket, IPPROTO_TCP, TCP_FASTOPEN, options.fastopen_queue))
+                && (options.receive_buffer == 0
+                    || set_option(socket, SOL_SOCKET, SO_RCVBUF, options.receive_buffer))
+                && (options.send_buffer == 0
+                    || set_option(socket, SOL_SOCKET, SO_SNDBUF, options.send_buffer));
+        }
+
+
+        // Pins the calling thread for the rest of its life
+        inline std::expected<void, std::error_code> pin_thread(int cpu) noexcept {
+            if(cpu < 0)
+                return {};
+            auto cpus = cpu_set_t{};
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+            if(auto const error = ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus);
+               error != 0)
+                return std::unexpected(std::error_code{error, std::system_category()});
+            return {};
+        }
+
+    } // namespace detail
+
+
     class tcp_server_observer {
     public:
-        virtual void on_connected(int client_socket, sockaddr_in const&) = 0;
+        virtual ~tcp_server_observer() = default;
+        virtual bool on_connected(int client_socket, sockaddr_in const&) = 0;
         virtual void on_disconnected(int client_socket) = 0;
-        virtual void on_data_ready(int client_socket) = 0;
+        virtual tcp_response on_data_ready(int client_socket) = 0;
+        // Timeout set by tcp_server::set_timeout() is expired
+        virtual tcp_response on_timeout(int) { return tcp_response::close_connection; }
+        // Server is draining, connection is closed when its queued bytes
+        // are sent unless observer waits for it to finish
+        virtual tcp_response on_draining(int) { return tcp_response::close_connection; }
     }; // tcp_server_observer
 
 
+    // What tcp_data_observer has done with received bytes
+    struct tcp_consumed {
+        std::size_t bytes;
+        tcp_response response{tcp_response::await_next_data};
+    }; // tcp_consumed
+
+
+    // Observer of bytes read by the server itself: socket is read until
+    // EAGAIN into connection's receive buffer, so several messages
+    // received together are passed in one call. Bytes sent to connection
+    // meanwhile are held and go out together when the socket is drained
+    class tcp_data_observer : public tcp_server_observer {
+    public:
+        // Bytes are valid during the call only, bytes not consumed are
+        // passed again followed by the next received ones
+        virtual tcp_consumed on_data(int client_socket, std::span<char const> data) = 0;
+
+    private:
+        // Server reads instead of observer
+        virtual tcp_response on_data_ready(int) override final {
+            return tcp_response::await_next_data;
+        }
+    }; // tcp_data_observer
+
+
+    // Accepted connection passed from one thread to another
+    struct tcp_handoff {
+        int socket;
+        sockaddr_in address;
+    }; // tcp_handoff
+
+
+    using tcp_task = std::move_only_function<void()>;
+
+
     class tcp_server {
         using descriptors = std::vector<pollfd>;
 
-        bool stopping_{false};
+        // Listening socket goes first in poll descriptors (ignored by poll
+        // if absent), wakeup descriptor second, clients follow them
+        static constexpr auto poll_clients_offset = std::size_t{2};
+
+        tcp_server_options options_;
+        std::atomic<bool> stopping_{false};
+        // Loop is running, tasks posted otherwise would never run
+        std::atomic<bool> running_{false};
+        std::atomic<bool> draining_{false};
+        std::atomic<std::int64_t> drain_timeout_{0};
+        std::optional<timer_wheel::clock::time_point> drain_deadline_;
         tcp_server_observer* observer_{nullptr};
+        tcp_server_observer* serving_{nullptr};
+        // Observer being served if it wants bytes instead of descriptor
+        tcp_data_observer* receiving_{nullptr};
+        tcp_connections connections_;
+        int listener_{-1};
+        descriptors poll_ds_;
+        int epoll_fd_{-1};
+        // Ring capacity of shared memory connections accepted by
+        // listen_shm(), connections whose peer has written or read
+        // since they were served last
+        std::size_t shm_capacity_{0u};
+        std::vector<tcp_connection_id> shm_ready_;
+        std::vector<tcp_connection_id> shm_serving_;
+        io_ring ring_;
+        io_buffer_group ring_buffers_;
+        int ring_operations_{0};
+        bool ring_accept_paused_{false};
+        int wakeup_{-1};
+        int spare_fd_{-1};
+        bounded_queue<tcp_handoff> handoffs_;
+        bounded_queue<tcp_task> tasks_;
+        // Set by the first of producers since the last wakeup, so others
+        // do not write to wakeup descriptor again
+        std::atomic<bool> wakeup_pending_{false};
+        std::atomic<std::size_t> connections_count_{0u};
+        timer_wheel timers_;
 
     public:
 
+        using size_type = std::size_t;
+
         static constexpr auto default_buffer_size = 4096;
         static constexpr auto default_connection_requests_limit = 64;
+        static constexpr auto default_events_limit = 256;
+        static constexpr auto default_ring_entries = 1024u;
+        // Milliseconds to wait for events if no timeout is closer
+        static constexpr auto default_wait_timeout = 1000;
+
+        tcp_server(): tcp_server{tcp_server_options{}} { }
+
+        explicit tcp_server(tcp_engine engine)
+            : tcp_server{tcp_server_options{.engine = engine}} {
+        }
+
+        explicit tcp_server(tcp_server_options const& options)
+            : options_{options},
+              wakeup_{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+              spare_fd_{detail::open_spare_descriptor()},
+              handoffs_{options.handoffs_limit},
+              tasks_{options.tasks_limit},
+              timers_{options.timer_resolution} {
+            connections_.release_idle_buffers(options.release_idle_buffers);
+        }
 
-        tcp_server() = default;
         tcp_server(tcp_server const&) = delete;
         tcp_server& operator = (tcp_server const&) = delete;
-        tcp_server(tcp_server&&) = default;
-        tcp_server& operator = (tcp_server&&) = default;
-        ~tcp_server() { stop(); }
+        tcp_server(tcp_server&&) = delete;
+        tcp_server& operator = (tcp_server&&) = delete;
+
+        ~tcp_server() {
+            stop();
+            while(auto handoff = handoffs_.try_pop())
+                ::close(handoff->socket);
+            // Tasks not run are dropped
+            while(tasks_.try_pop()) { }
+            if(wakeup_ != -1)
+                ::close(wakeup_);
+            if(spare_fd_ != -1)
+                ::close(spare_fd_);
+        }
+
+
+        tcp_engine engine() const noexcept {
+            return options_.engine;
+        }
+
+
+        tcp_server_options const& options() const noexcept {
+            return options_;
+        }
 
-        
+
+        // Loop breaks as soon as it is woken up, can be called from any thread
         void stop() noexcept {
             stopping_ = true;
+            wake_up();
+        }
+
+
+        // Stops accepting and lets connections finish: observer's
+        // on_draining() is called for every connection and the loop ends
+        // when all of them are closed or 'timeout' passes. Can be called
+        // from any thread
+        void drain(std::chrono::milliseconds timeout) noexcept {
+            drain_timeout_ = timeout.count();
+            draining_ = true;
+            wake_up();
+        }
+
+
+        // Connections served or handed off to this server and not closed
+        // yet, can be called from any thread
+        size_type connections_count() const noexcept {
+            return connections_count_.load(std::memory_order_relaxed);
+        }
+
+
+        // Open connection by its socket, reactor thread only. Observer can
+        // keep its per-connection state in the connection context
+        tcp_connection* connection(int client_socket) const noexcept {
+            return connections_.find(client_socket);
+        }
+
+
+        tcp_connection* connection(tcp_connection_id id) const noexcept {
+            return connections_.find(id);
+        }
+
+
+        // Calls observer's on_timeout() for the connection after 'timeout'
+        // unless it is set again or cancelled, reactor thread only.
+        // Connection has one such timeout, arming and cancelling are O(1)
+        bool set_timeout(int client_socket, std::chrono::milliseconds timeout) noexcept {
+            auto* connection = connections_.find(client_socket);
+            if(connection == nullptr || connection->closing)
+                return false;
+            timers_.arm(connection->timer, timeout);
+            return true;
+        }
+
+
+        void cancel_timeout(int client_socket) noexcept {
+            if(auto* connection = connections_.find(client_socket); connection != nullptr)
+                timers_.cancel(connection->timer);
+        }
+
+
+        // Closes connection when its queued bytes are sent, reactor thread
+        // only. Observer is notified as usual, so it should not be called
+        // from observer's callbacks about the same connection
+        void close(int client_socket) {
+            auto* connection = connections_.find(client_socket);
+            if(connection == nullptr || connection->closing || serving_ == nullptr)
+                return;
+            close_after_flush(*serving_, *connection);
+        }
+
+
+        // Bytes sent to connection are queued from now on until
+        // release_output(), so responses to pipelined requests go out with
+        // one system call. Reactor thread only
+        void hold_output(int client_socket) noexcept {
+            if(auto* connection = connections_.find(client_socket); connection != nullptr)
+                connection->tx_held = true;
+        }
+
+
+        // Sends bytes queued since hold_output() together, reactor thread only
+        std::expected<void, std::error_code> release_output(int client_socket) {
+            auto* connection = connections_.find(client_socket);
+            if(connection == nullptr || !connection->tx_held)
+                return {};
+            connection->tx_held = false;
+            if(connection->closing)
+                return {};
+            if(options_.engine != tcp_engine::io_uring && !connection->tx.empty())
+                if(auto written = write_queued(*connection); !written)
+                    return std::unexpected(written.error());
+            return transmit(*connection);
+        }
+
+
+        // Passes connection accepted by another thread to this server,
+        // returns false if too many connections are waiting already.
+        // Can be called from any thread
+        bool adopt(int client_socket, sockaddr_in const& address) {
+            if(wakeup_ == -1 || !handoffs_.try_push(client_socket, address))
+                return false;
+            connections_count_.fetch_add(1, std::memory_order_relaxed);
+            wake_up();
+            return true;
         }
 
-        
+
+        // Runs 'task' on the reactor thread, returns false if server is not
+        // serving or too many tasks are waiting already. Tasks not run by
+        // the time serving ends are dropped. Can be called from any thread.
+        // Task should find its connection by tcp_connection_id, since
+        // socket descriptor can be reused by the time task is run
+        bool post(tcp_task task) {
+            if(wakeup_ == -1 || !running_.load() || !tasks_.try_push(std::move(task)))
+                return false;
+            wake_up();
+            return true;
+        }
+
+
+        // Sends 'data' to the client socket, reactor thread only. Bytes the
+        // socket can not take right away are copied and sent as soon as it
+        // becomes writable, so slow client never blocks the others. With
+        // io_uring engine bytes are submitted with the next wait of the loop
+        std::expected<void, std::error_code>
+        send(int client_socket, std::span<char const> data) {
+            auto* connection = connections_.find(client_socket);
+            if(connection == nullptr || connection->closing)
+                return std::unexpected(std::make_error_code(std::errc::not_connected));
+            // Optimistic write if nothing is queued or held already
+            if(connection->shm && !connection->tx_held && connection->tx.empty())
+                data = data.subspan(connection->shm->write(data));
+            while(options_.engine != tcp_engine::io_uring && !connection->shm
+                  && !connection->tx_held && !data.empty() && connection->tx.empty()) {
+                auto const tx_result = ::send(client_socket, data.data(), data.size(),
+                                              MSG_NOSIGNAL);
+                if(tx_result == -1) {
+                    if(errno == EINTR)
+                        continue;
+                    if(errno == EAGAIN)
+                        break;
+                    return detail::make_unexpected_from_errno();
+                }
+                data = data.subspan(std::size_t(tx_result));
+            }
+            if(data.empty())
+                return {};
+            if(options_.release_idle_buffers)
+                connections_.borrow_tx(*connection);
+            connection->tx.copy(data);
+            return transmit(*connection);
+        }
+
+
+        // Sends all segments of 'output' in order without copying them,
+        // several segments go out with one system call
+        std::expected<void, std::error_code>
+        send(int client_socket, tcp_output&& output) {
+            auto* connection = connections_.find(client_socket);
+            if(connection == nullptr || connection->closing)
+                return std::unexpected(std::make_error_code(std::errc::not_connected));
+            // Output is taken as is by idle connection, nothing to borrow
+            auto const idle = connection->tx.empty();
+            connection->tx.append(std::move(output));
+            if(idle && !connection->tx_held && options_.engine != tcp_engine::io_uring)
+                if(auto written = write_queued(*connection); !written)
+                    return std::unexpected(written.error());
+            return transmit(*connection);
+        }
+
+
         void observe(tcp_server_observer* observer) noexcept {
             observer_ = observer;
         }
@@ -95,114 +612,1358 @@ namespace inter {
         void ignore() noexcept {
             observer_ = nullptr;
         }
-        
 
-        std::expected<void, std::error_code>
-        listen(std::int16_t port,
-               tcp_server_observer& observer,
-               int connection_requests_limit = default_connection_requests_limit) {
-            auto const server_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+
+        // Opens non-blocking listening socket bound to all interfaces with
+        // SO_REUSEPORT, so several sockets can share the same port
+        static std::expected<int, std::error_code>
+        open_listener(std::int16_t port,
+                      int connection_requests_limit = default_connection_requests_limit) {
+            return open_listener(port, tcp_socket_options{}, connection_requests_limit);
+        }
+
+
+        // Opens non-blocking listening socket with SO_REUSEPORT tuned by
+        // 'options', accepted sockets are tuned by tcp_server itself
+        static std::expected<int, std::error_code>
+        open_listener(std::int16_t port,
+                      tcp_socket_options const& options,
+                      int connection_requests_limit = default_connection_requests_limit) {
+            auto addr = sockaddr_in{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            if(::inet_pton(AF_INET, options.bind_address.c_str(), &addr.sin_addr) != 1)
+                return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+            auto const server_socket = ::socket(AF_INET,
+                                                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                                0);
             if(server_socket == -1)
                 return detail::make_unexpected_from_errno();
             int const reuse = 1;
             if(setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
-                return detail::make_unexpected_from_errno();
-            auto addr = sockaddr_in{};
-            addr.sin_family = AF_INET;
-            addr.sin_port = htons(port);
-            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+                return close_on_error(server_socket);
+            if(!detail::set_listener_options(server_socket, options))
+                return close_on_error(server_socket);
             auto const binded = ::bind(server_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
             if(binded == -1)
-                return detail::make_unexpected_from_errno();
+                return close_on_error(server_socket);
             auto const listened = ::listen(server_socket, connection_requests_limit);
             if(listened == -1)
+                return close_on_error(server_socket);
+            return server_socket;
+        }
+
+
+        // Opens non-blocking listening Unix domain stream socket, previous
+        // socket at 'path' is removed. Path starting with '@' is in abstract
+        // namespace and has no file
+        static std::expected<int, std::error_code>
+        open_unix_listener(char const* path,
+                           int connection_requests_limit = default_connection_requests_limit) {
+            auto const address = detail::make_unix_address(path);
+            if(!address)
+                return std::unexpected(address.error());
+            auto const server_socket = ::socket(AF_UNIX,
+                                                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                                0);
+            if(server_socket == -1)
+                return detail::make_unexpected_from_errno();
+            if(!address->abstract())
+                detail::remove_stale_socket(path);
+            if(::bind(server_socket, address->data(), address->size) == -1)
+                return close_on_error(server_socket);
+            if(::listen(server_socket, connection_requests_limit) == -1)
+                return close_on_error(server_socket);
+            return server_socket;
+        }
+
+
+        // Opens non-blocking listening socket shm_channel::connect() dials,
+        // same as open_unix_listener() otherwise
+        static std::expected<int, std::error_code>
+        open_shm_listener(char const* path,
+                          int connection_requests_limit = default_connection_requests_limit) {
+            auto const address = detail::make_unix_address(path);
+            if(!address)
+                return std::unexpected(address.error());
+            auto const server_socket = ::socket(AF_UNIX,
+                                                SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                                0);
+            if(server_socket == -1)
                 return detail::make_unexpected_from_errno();
-            poll_ds = descriptors{};
-            poll_ds.push_back(pollfd {
+            if(!address->abstract())
+                detail::remove_stale_socket(path);
+            if(::bind(server_socket, address->data(), address->size) == -1)
+                return close_on_error(server_socket);
+            if(::listen(server_socket, connection_requests_limit) == -1)
+                return close_on_error(server_socket);
+            return server_socket;
+        }
+
+
+        std::expected<void, std::error_code>
+        listen(std::int16_t port,
+               tcp_server_observer& observer,
+               int connection_requests_limit = default_connection_requests_limit) {
+            auto const server_socket = open_listener(port, options_.socket,
+                                                     connection_requests_limit);
+            if(!server_socket)
+                return std::unexpected(server_socket.error());
+            return serve(*server_socket, observer);
+        }
+
+
+        // Serves Unix domain socket with the same observer as TCP one,
+        // address of connection has AF_UNIX family and no other fields
+        std::expected<void, std::error_code>
+        listen_unix(char const* path,
+                    tcp_server_observer& observer,
+                    int connection_requests_limit = default_connection_requests_limit) {
+            auto const server_socket = open_unix_listener(path, connection_requests_limit);
+            if(!server_socket)
+                return std::unexpected(server_socket.error());
+            return serve(*server_socket, observer);
+        }
+
+
+        // Serves clients on the same host connecting with
+        // shm_channel::connect() to Unix domain socket at 'path', their bytes
+        // go through shared memory rings of 'ring_capacity' bytes each.
+        // Observer is notified as for sockets. Epoll engine only
+        std::expected<void, std::error_code>
+        listen_shm(char const* path,
+                   tcp_data_observer& observer,
+                   size_type ring_capacity = shm_channel::default_capacity,
+                   int connection_requests_limit = default_connection_requests_limit) {
+            if(options_.engine != tcp_engine::epoll)
+                return std::unexpected(std::make_error_code(std::errc::operation_not_supported));
+            auto const server_socket = open_shm_listener(path, connection_requests_limit);
+            if(!server_socket)
+                return std::unexpected(server_socket.error());
+            shm_capacity_ = ring_capacity;
+            auto result = serve(*server_socket, observer);
+            shm_capacity_ = 0u;
+            return result;
+        }
+
+
+        // Serves listening socket received from a predecessor process with
+        // receive_listeners(), socket is closed on return
+        std::expected<void, std::error_code>
+        listen_inherited(int server_socket, tcp_server_observer& observer) {
+            if(!detail::is_listening(server_socket)) {
+                ::close(server_socket);
+                return std::unexpected(std::make_error_code(std::errc::invalid_argument));
+            }
+            return serve(server_socket, observer);
+        }
+
+
+        // Sends listening socket to a successor process, it is served here
+        // as well until this server is drained or stopped. Reactor thread
+        // only, other threads can post() it
+        std::expected<void, std::error_code>
+        export_listener(int channel, std::uint32_t count = 1) const {
+            if(listener_ == -1)
+                return std::unexpected(std::make_error_code(std::errc::bad_file_descriptor));
+            return send_listener(channel, listener_, count);
+        }
+
+
+        // Serves only connections passed by adopt() until stopped
+        std::expected<void, std::error_code>
+        run(tcp_server_observer& observer) {
+            return serve(-1, observer);
+        }
+
+
+        // Serves already listening socket until stopped, socket is made
+        // non-blocking and is closed on return
+        std::expected<void, std::error_code>
+        serve(int server_socket, tcp_server_observer& observer) {
+            if(wakeup_ == -1) {
+                if(server_socket != -1)
+                    ::close(server_socket);
+                return std::unexpected(std::make_error_code(std::errc::bad_file_descriptor));
+            }
+            if(server_socket != -1 && !detail::make_nonblocking(server_socket))
+                return close_on_error(server_socket);
+            if(server_socket != -1)
+                if(auto tuned = detail::set_busy_poll(server_socket, options_); !tuned) {
+                    ::close(server_socket);
+                    return tuned;
+                }
+            if(auto pinned = detail::pin_thread(options_.cpu); !pinned) {
+                if(server_socket != -1)
+                    ::close(server_socket);
+                return pinned;
+            }
+            // SIGPIPE stays blocked while serving, so sendfile() does not
+            // change signal mask for every file range
+            auto const sigpipe = detail::sigpipe_guard{};
+            listener_ = server_socket;
+            serving_ = &observer;
+            receiving_ = dynamic_cast<tcp_data_observer*>(&observer);
+            running_ = true;
+            auto const result = [&] {
+                switch(options_.engine) {
+                    case tcp_engine::poll:
+                        return run_poll(server_socket, observer);
+                    case tcp_engine::epoll:
+                        return run_epoll(server_socket, observer);
+                    case tcp_engine::io_uring:
+                        return run_ring(server_socket, observer);
+                }
+                return run_poll(server_socket, observer);
+            }();
+            running_ = false;
+            while(tasks_.try_pop()) { }
+            shm_ready_.clear();
+            stopping_ = false;
+            draining_ = false;
+            drain_deadline_.reset();
+            // Listener is closed already if server was drained
+            if(listener_ != -1)
+                ::close(listener_);
+            listener_ = -1;
+            close_all(observer);
+            serving_ = nullptr;
+            receiving_ = nullptr;
+            return result;
+        }
+
+
+    private:
+
+        static std::unexpected<std::error_code> close_on_error(int socket) noexcept {
+            auto const error = detail::make_unexpected_from_errno();
+            if(socket != -1)
+                ::close(socket);
+            return error;
+        }
+
+
+        void accept_connections(int server_socket, tcp_server_observer& observer) {
+            detail::accept_pending(server_socket, spare_fd_, options_.accept_batch,
+                                   [&](int client_socket, sockaddr_in const& client_addr) {
+                if(shm_capacity_ == 0u)
+                    return open_connection(observer, client_socket, client_addr);
+                // Client socket is closed by the channel if it fails
+                auto channel = shm_channel::offer(client_socket, shm_capacity_);
+                if(channel)
+                    open_connection(observer, client_socket, client_addr, std::move(*channel));
+            });
+        }
+
+
+        void wake_up() noexcept {
+            if(wakeup_ == -1 || wakeup_pending_.exchange(true))
+                return;
+            auto const one = std::uint64_t{1};
+            (void)::write(wakeup_, &one, sizeof(one));
+        }
+
+
+        // Resets wakeup counter, opens every waiting connection and runs
+        // every waiting task
+        void handle_wakeup(tcp_server_observer& observer) {
+            // Producers coming after this point write to descriptor again
+            wakeup_pending_.store(false);
+            auto counter = std::uint64_t{};
+            (void)::read(wakeup_, &counter, sizeof(counter));
+            take_handoffs(observer);
+            if(draining_ && !drain_deadline_)
+                begin_drain(observer);
+            // Tasks posted meanwhile wait for the next wakeup, so they can
+            // not hold the loop forever
+            for(auto n = tasks_.capacity(); n != 0 && !stopping_; --n) {
+                auto task = tasks_.try_pop();
+                if(!task)
+                    break;
+                (*task)();
+            }
+        }
+
+
+        void begin_drain(tcp_server_observer& observer) {
+            drain_deadline_ = timer_wheel::clock::now()
+                            + std::chrono::milliseconds{drain_timeout_.load()};
+            stop_accepting(observer);
+            // Closing connections does not move the others
+            connections_.for_each([&](tcp_connection& connection) {
+                if(!connection.closing)
+                    drain_connection(observer, connection);
+            });
+        }
+
+
+        void drain_connection(tcp_server_observer& observer, tcp_connection& connection) {
+            if(observer.on_draining(connection.socket) == tcp_response::close_connection)
+                close_after_flush(observer, connection);
+        }
+
+
+        // Serves connections waiting in the listening queue already and
+        // closes listening socket, so new connections go to other
+        // listeners of the port
+        void stop_accepting(tcp_server_observer& observer) {
+            if(listener_ == -1)
+                return;
+            accept_connections(listener_, observer);
+            switch(options_.engine) {
+                case tcp_engine::poll:
+                    poll_ds_[0].fd = -1;
+                    break;
+                case tcp_engine::epoll:
+                    // Closing descriptor removes it from epoll interest list
+                    break;
+                case tcp_engine::io_uring:
+                    // Cancellation finds accept by descriptor, so it is
+                    // submitted while descriptor is open
+                    if(auto* sqe = ring_sqe(); sqe != nullptr) {
+                        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                        sqe->fd = listener_;
+                        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+                        sqe->user_data = ring_data(ring_cancel, nullptr);
+                        ++ring_operations_;
+                        (void)ring_.submit();
+                    }
+                    break;
+            }
+            ::close(listener_);
+            listener_ = -1;
+        }
+
+
+        // Draining is over when every connection is closed or time is out
+        bool drained() const noexcept {
+            return drain_deadline_
+                && (connections_.empty() || timer_wheel::clock::now() >= *drain_deadline_);
+        }
+
+
+        void take_handoffs(tcp_server_observer& observer) {
+            while(auto handoff = handoffs_.try_pop()) {
+                // Handed off connection is counted already by adopt()
+                connections_count_.fetch_sub(1, std::memory_order_relaxed);
+                if(!detail::make_nonblocking(handoff->socket)) {
+                    ::close(handoff->socket);
+                    continue;
+                }
+                open_connection(observer, handoff->socket, handoff->address);
+            }
+        }
+
+
+        void open_connection(tcp_server_observer& observer,
+                             int client_socket,
+                             sockaddr_in const& client_addr,
+                             std::optional<shm_channel> shm = std::nullopt) {
+            // TCP options do not apply to Unix domain sockets
+            if(client_addr.sin_family == AF_INET
+               && !detail::set_connection_options(client_socket, options_.socket))
+                return void(::close(client_socket));
+            // Connection is known to the server while observer decides
+            auto& connection = connections_.open(client_socket, client_addr);
+            connection.shm = std::move(shm);
+            connection.timer.tag = reinterpret_cast<std::uintptr_t>(&connection);
+            connection.tx_timer.tag = reinterpret_cast<std::uintptr_t>(&connection);
+            if(!observer.on_connected(client_socket, client_addr)) {
+                close_socket(connection);
+                return forget_connection(connection);
+            }
+            connections_count_.fetch_add(1, std::memory_order_relaxed);
+            if(!register_connection(connection))
+                return close_connection(observer, connection);
+            // Accepted or handed off while server is draining
+            if(drain_deadline_)
+                drain_connection(observer, connection);
+        }
+
+
+        void forget_connection(tcp_connection& connection) noexcept {
+            timers_.cancel(connection.timer);
+            timers_.cancel(connection.tx_timer);
+            connections_.close(connection.socket);
+        }
+
+
+        bool register_connection(tcp_connection& connection) {
+            switch(options_.engine) {
+                case tcp_engine::poll:
+                    connection.poll_index = poll_ds_.size();
+                    poll_ds_.push_back(pollfd {
+                        .fd = connection.socket,
+                        .events = POLLIN,
+                        .revents = 0
+                    });
+                    return true;
+                case tcp_engine::epoll: {
+                    // Edge-triggered EPOLLOUT is reported only after socket
+                    // was full, so it can stay registered all the time
+                    auto client_event = epoll_event{};
+                    client_event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    client_event.data.ptr = &connection;
+                    if(!connection.shm)
+                        return ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD,
+                                           connection.socket, &client_event) != -1;
+                    // Peer notifies through channel's eventfd, socket only
+                    // tells that peer is gone
+                    auto channel_event = client_event;
+                    channel_event.events = EPOLLIN | EPOLLET;
+                    client_event.events = EPOLLRDHUP | EPOLLET;
+                    if(::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD,
+                                   connection.socket, &client_event) == -1
+                       || ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD,
+                                      connection.shm->event_descriptor(), &channel_event) == -1)
+                        return false;
+                    watch_shm(connection);
+                    return true;
+                }
+                case tcp_engine::io_uring:
+                    return ring_buffers_.is_open()
+                        ? ring_receive_connection(connection)
+                        : ring_poll_connection(connection);
+            }
+            return false;
+        }
+
+
+        // Returns false if connection is closed
+        bool handle_data(tcp_server_observer& observer, tcp_connection& connection) {
+            if(connection.reading_paused) {
+                connection.read_pending = true;
+                return true;
+            }
+            auto const response = receiving_ != nullptr
+                ? receive(*receiving_, connection)
+                : observer.on_data_ready(connection.socket);
+            switch(response) {
+                case tcp_response::close_connection:
+                    return close_after_flush(observer, connection);
+                case tcp_response::await_next_data:
+                    if(options_.socket.quick_ack && connection.address.sin_family == AF_INET)
+                        (void)detail::set_option(connection.socket, IPPROTO_TCP, TCP_QUICKACK, 1);
+                    return true;
+            }
+            return true;
+        }
+
+
+        tcp_response receive(tcp_data_observer& observer, tcp_connection& connection) {
+            for(;;) {
+                // Replies to all bytes received together go out together
+                connection.tx_held = true;
+                if(options_.release_idle_buffers)
+                    connections_.borrow_rx(connection);
+                auto const response = receive_bytes(observer, connection);
+                if(options_.release_idle_buffers)
+                    connections_.return_rx(connection);
+                if(!release_output(connection.socket))
+                    return tcp_response::close_connection;
+                // Reading paused by held replies goes on if they are sent
+                // right away, no writability is reported for them then
+                if(response == tcp_response::close_connection || !connection.reading_paused
+                   || connection.close_after_flush
+                   || connection.tx_queued() > options_.tx_low_watermark)
+                    return response;
+                connection.reading_paused = false;
+                update_poll_events(connection);
+                if(!connection.read_pending)
+                    return response;
+                connection.read_pending = false;
+            }
+        }
+
+
+        // Reads connection until EAGAIN and passes bytes to observer when
+        // socket is drained or buffer is full
+        tcp_response receive_bytes(tcp_data_observer& observer, tcp_connection& connection) {
+            auto& rx = connection.rx;
+            for(;;) {
+                auto const received = read_connection(connection);
+                if(received && *received != 0u)
+                    continue;
+                auto const full = !received && received.error() == std::errc::no_buffer_space;
+                auto const drained = !received
+                    && received.error() == std::errc::resource_unavailable_try_again;
+                if(!received && !full && !drained)
+                    return tcp_response::close_connection;
+                auto const buffered = rx.size();
+                if(buffered != 0u) {
+                    auto const consumed = observer.on_data(connection.socket, rx.data());
+                    rx.consume(consumed.bytes);
+                    if(consumed.response == tcp_response::close_connection)
+                        return tcp_response::close_connection;
+                }
+                // Peer has closed connection or observer waits for more
+                // bytes than the limit allows
+                if(received || (full && rx.size() == buffered))
+                    return tcp_response::close_connection;
+                if(drained)
+                    return tcp_response::await_next_data;
+                // Too many bytes are queued for sending meanwhile
+                if(connection.reading_paused) {
+                    connection.read_pending = true;
+                    return tcp_response::await_next_data;
+                }
+            }
+        }
+
+
+        // Reads once into receive buffer, results are the ones of
+        // tcp_rx_buffer::read_from()
+        std::expected<std::size_t, std::error_code> read_connection(tcp_connection& connection) {
+            if(!connection.shm)
+                return connection.rx.read_from(connection.socket, options_.rx_buffer_limit,
+                                               options_.mirrored_rx_buffers);
+            auto& channel = *connection.shm;
+            auto const space = connection.rx.prepare(tcp_rx_buffer::min_read_size,
+                                                     options_.rx_buffer_limit,
+                                                     options_.mirrored_rx_buffers);
+            if(space.empty())
+                return std::unexpected(std::make_error_code(std::errc::no_buffer_space));
+            // Bytes written before peer has closed its side are read first
+            auto const closed = channel.peer_closed();
+            auto const received = channel.read(space);
+            connection.rx.commit(received);
+            if(received != 0u)
+                return received;
+            if(channel.corrupted())
+                return std::unexpected(std::make_error_code(std::errc::bad_message));
+            if(closed)
+                return 0u;
+            return std::unexpected(std::make_error_code(std::errc::resource_unavailable_try_again));
+        }
+
+
+        // Writes queued bytes until socket or ring is full
+        std::expected<std::size_t, std::error_code> write_queued(tcp_connection& connection) {
+            if(!connection.shm) {
+                if(options_.release_idle_buffers)
+                    connections_.borrow_iovecs(connection);
+                auto& iovecs = connection.tx_iovecs;
+                iovecs.resize(std::min(connection.tx.segments_count(), tcp_output::gather_limit));
+                return connection.tx.write_to(connection.socket, iovecs);
+            }
+            auto& channel = *connection.shm;
+            auto const written = connection.tx.copy_to([&](std::span<char const> bytes) {
+                return channel.write(bytes);
+            });
+            if(written && channel.corrupted())
+                return std::unexpected(std::make_error_code(std::errc::bad_message));
+            return written;
+        }
+
+
+        // Shared memory connection sleeps until peer writes or reads,
+        // connection peer did it for meanwhile is served on the next turn.
+        // Busy polling serves every turn, so peer never has to notify
+        void watch_shm(tcp_connection& connection) {
+            if(connection.shm_ready)
+                return;
+            auto const waiting = (connection.reading_paused ? 0u : std::uint32_t(shm_waiting_data))
+                | (connection.tx_queued() != 0u ? std::uint32_t(shm_waiting_space) : 0u);
+            if(!options_.busy_poll && connection.shm->wait_for(waiting))
+                return;
+            connection.shm_ready = true;
+            shm_ready_.push_back(connection.id());
+        }
+
+
+        void serve_shm(tcp_server_observer& observer,
+                       tcp_connection& connection,
+                       std::uint32_t flags) {
+            auto& channel = *connection.shm;
+            // Peer writes without notifying while this side is busy
+            channel.stop_waiting();
+            if(flags & EPOLLIN)
+                channel.clear_event();
+            if(flags & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                channel.hang_up();
+            if(connection.tx_queued() != 0 && !flush_connection(observer, connection))
+                return;
+            auto const readable = channel.readable();
+            if(!handle_data(observer, connection))
+                return;
+            // Peer gone takes no queued bytes, so connection is served
+            // again only while its last bytes are being read
+            if(channel.peer_closed() && (channel.readable() == 0u || channel.readable() == readable))
+                return close_connection(observer, connection);
+            watch_shm(connection);
+        }
+
+
+        void serve_ready_shm(tcp_server_observer& observer) {
+            shm_serving_.swap(shm_ready_);
+            for(auto const id: shm_serving_)
+                if(auto* connection = connections_.find(id); connection != nullptr) {
+                    connection->shm_ready = false;
+                    serve_shm(observer, *connection, 0u);
+                }
+            shm_serving_.clear();
+        }
+
+
+        // Closes connection when all queued bytes are sent, returns false if
+        // connection is closed right away
+        bool close_after_flush(tcp_server_observer& observer, tcp_connection& connection) {
+            if(connection.tx_queued() == 0) {
+                close_connection(observer, connection);
+                return false;
+            }
+            connection.close_after_flush = true;
+            pause_reading(connection);
+            return true;
+        }
+
+
+        void update_poll_events(tcp_connection& connection) {
+            if(options_.engine != tcp_engine::poll)
+                return;
+            auto& poll_d = poll_ds_[connection.poll_index];
+            poll_d.events = (connection.reading_paused ? 0 : POLLIN)
+                          | (connection.tx_queued() != 0 ? POLLOUT : 0);
+        }
+
+
+        void pause_reading(tcp_connection& connection) {
+            // Multishot receive would go on while reading is paused
+            if(!connection.reading_paused && connection.receiving)
+                ring_stop_receiving(connection);
+            connection.reading_paused = true;
+            update_poll_events(connection);
+        }
+
+
+        // Returns false if connection is closed
+        bool resume_reading(tcp_server_observer& observer, tcp_connection& connection) {
+            connection.reading_paused = false;
+            update_poll_events(connection);
+            if(ring_buffers_.is_open())
+                return ring_resume_receiving(observer, connection);
+            if(!connection.read_pending)
+                return true;
+            // Edge-triggered engines do not report readiness again
+            connection.read_pending = false;
+            return handle_data(observer, connection);
+        }
+
+
+        void on_queued(tcp_connection& connection) {
+            if(options_.write_timeout.count() > 0 && !connection.tx_timer.armed())
+                timers_.arm(connection.tx_timer, options_.write_timeout);
+            if(connection.tx_queued() > options_.tx_high_watermark)
+                pause_reading(connection);
+            else
+                update_poll_events(connection);
+            // Bytes queued out of serving wait for peer to read
+            if(connection.shm)
+                watch_shm(connection);
+        }
+
+
+        // Returns false if connection is closed
+        bool on_flushed(tcp_server_observer& observer, tcp_connection& connection) {
+            auto const queued = connection.tx_queued();
+            // Write timeout counts from the last progress
+            if(queued == 0)
+                timers_.cancel(connection.tx_timer);
+            if(queued == 0 && options_.release_idle_buffers)
+                connections_.return_tx(connection);
+            else if(connection.tx_timer.armed())
+                timers_.arm(connection.tx_timer, options_.write_timeout);
+            if(queued == 0 && connection.close_after_flush) {
+                close_connection(observer, connection);
+                return false;
+            }
+            if(connection.reading_paused && !connection.close_after_flush
+               && queued <= options_.tx_low_watermark)
+                return resume_reading(observer, connection);
+            update_poll_events(connection);
+            return true;
+        }
+
+
+        // Queued bytes are sent by the loop from now on
+        std::expected<void, std::error_code> transmit(tcp_connection& connection) {
+            // Held bytes are sent by release_output(), reading stops meanwhile
+            // if too many of them are queued
+            if(connection.tx_held) {
+                if(connection.tx_queued() > options_.tx_high_watermark)
+                    pause_reading(connection);
+                return {};
+            }
+            // Everything was written right away, nothing to time out
+            if(connection.tx.empty()) {
+                if(options_.release_idle_buffers)
+                    connections_.return_tx(connection);
+                return {};
+            }
+            if(options_.engine == tcp_engine::io_uring && !connection.tx_in_flight)
+                if(auto submitted = ring_send_connection(connection); !submitted)
+                    return submitted;
+            on_queued(connection);
+            return {};
+        }
+
+
+        // Writes queued bytes until socket is full, poll and epoll engines.
+        // Returns false if connection is closed
+        bool flush_connection(tcp_server_observer& observer, tcp_connection& connection) {
+            if(!write_queued(connection)) {
+                close_connection(observer, connection);
+                return false;
+            }
+            return on_flushed(observer, connection);
+        }
+
+
+        void close_connection(tcp_server_observer& observer, tcp_connection& connection) {
+            auto const client_socket = connection.socket;
+            switch(options_.engine) {
+                case tcp_engine::poll: {
+                    // Swap with the last descriptor and pop it
+                    auto const index = connection.poll_index;
+                    if(index != poll_ds_.size() - 1) {
+                        poll_ds_[index] = poll_ds_.back();
+                        connections_.find(poll_ds_[index].fd)->poll_index = index;
+                    }
+                    poll_ds_.pop_back();
+                    break;
+                }
+                case tcp_engine::epoll:
+                    // Closing descriptor removes it from epoll interest list
+                    break;
+                case tcp_engine::io_uring:
+                    return close_ring_connection(observer, connection);
+            }
+            close_socket(connection);
+            connections_count_.fetch_sub(1, std::memory_order_relaxed);
+            observer.on_disconnected(client_socket);
+            forget_connection(connection);
+        }
+
+
+        // Shared memory channel owns the socket
+        static void close_socket(tcp_connection& connection) noexcept {
+            if(connection.shm)
+                connection.shm.reset();
+            else
+                ::close(connection.socket);
+        }
+
+
+        int wait_timeout() const noexcept {
+            if(options_.busy_poll || !shm_ready_.empty())
+                return 0;
+            using std::chrono::milliseconds;
+            auto timeout = milliseconds{default_wait_timeout};
+            if(auto const next = timers_.next_timeout(); next)
+                timeout = std::min(timeout, *next);
+            if(drain_deadline_) {
+                auto const left = std::chrono::ceil<milliseconds>(
+                    *drain_deadline_ - timer_wheel::clock::now());
+                timeout = std::clamp(left, milliseconds{0}, timeout);
+            }
+            return int(timeout.count());
+        }
+
+
+        void expire_timers(tcp_server_observer& observer) {
+            timers_.advance(timer_wheel::clock::now(), [&](timer_node& timer) {
+                auto& connection = *reinterpret_cast<tcp_connection*>(timer.tag);
+                if(&timer == &connection.tx_timer)
+                    return close_connection(observer, connection);
+                if(observer.on_timeout(connection.socket) == tcp_response::close_connection)
+                    close_after_flush(observer, connection);
+            });
+        }
+
+
+        void close_all(tcp_server_observer& observer) {
+            connections_.for_each([&](tcp_connection& connection) {
+                timers_.cancel(connection.timer);
+                timers_.cancel(connection.tx_timer);
+                close_socket(connection);
+                if(connection.closing)
+                    return;
+                connections_count_.fetch_sub(1, std::memory_order_relaxed);
+                observer.on_disconnected(connection.socket);
+            });
+            connections_.clear();
+            poll_ds_.clear();
+        }
+
+
+        std::expected<void, std::error_code>
+        run_poll(int server_socket, tcp_server_observer& observer) {
+            poll_ds_.clear();
+            poll_ds_.push_back(pollfd {
                 .fd = server_socket,
-                .events = POLLIN
+                .events = POLLIN,
+                .revents = 0
             });
-            auto rx_buffer = std::vector<char>{buffer_size};
-            while(!stopping_) {
-                auto const polled_count = poll(poll_ds_.data(), poll_ds_.size(), 1000);
+            poll_ds_.push_back(pollfd {
+                .fd = wakeup_,
+                .events = POLLIN,
+                .revents = 0
+            });
+            while(!stopping_ && !drained()) {
+                auto const polled_count = ::poll(poll_ds_.data(), poll_ds_.size(),
+                                                 wait_timeout());
+                // Timers are armed relative to the time of wakeup
+                expire_timers(observer);
                 if(polled_count <= 0)
                     continue;
                 auto handled_count = 0;
-                if(poll_ds[0].revents & POLLIN) {
+                if(poll_ds_[0].revents & POLLIN) {
+                    ++handled_count;
+                    accept_connections(server_socket, observer);
+                }
+                if(poll_ds_[1].revents & POLLIN) {
+                    ++handled_count;
+                    handle_wakeup(observer);
+                }
+                // Descriptors added above have no events yet. Closed
+                // descriptor is replaced by the last one, which is not
+                // visited yet, so index advances only if nothing is closed
+                auto index = poll_clients_offset;
+                while(handled_count != polled_count && index < poll_ds_.size()) {
+                    auto const revents = poll_ds_[index].revents;
+                    if(!(revents & (POLLIN | POLLOUT | POLLHUP | POLLERR))) {
+                        ++index;
+                        continue;
+                    }
                     ++handled_count;
-                    auto client_addr = sockaddr_in{};
-                    auto const client_socket = ::accept(server_socket,
-                                                        reinterpret_cast<sokaddr*>(&client_addr),
-                                                        sizeof(client_addr));
-                    auto const accepted = observer.on_connected(client_socket, client_addr);
-                    if(accepted)
-                        poll_ds.push_back(pollfd {
-                            .fd = client_socket,
-                            .events = POLLIN
-                        });
-                    else
-                        ::close(client_socket);
-                }
-                auto it = poll_ds_.begin() + 1;
-                while(handled_count != polled_count && it != poll_ds_.end()) {
-                    handle_socket(handled_count, rx_buffer, observer, poll_ds, it);
+                    auto& connection = *connections_.find(poll_ds_[index].fd);
+                    auto open = true;
+                    if(revents & POLLOUT)
+                        open = flush_connection(observer, connection);
+                    if(open && (revents & (POLLIN | POLLHUP | POLLERR)))
+                        open = handle_data(observer, connection);
+                    if(open)
+                        ++index;
                 }
             }
-            stopping_ = false;
-            for(auto& poll_dr: poll_ds) {
-                ::close(poll_dr.fd);
-                observer.on_disconnected(poll_dr.fd);
+            return {};
+        }
+
+
+        std::expected<void, std::error_code>
+        run_epoll(int server_socket, tcp_server_observer& observer) {
+            epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+            if(epoll_fd_ == -1)
+                return detail::make_unexpected_from_errno();
+            // Listening socket is level-triggered and marked by null pointer,
+            // wakeup descriptor is marked by pointer to it
+            auto server_event = epoll_event{};
+            server_event.events = EPOLLIN;
+            server_event.data.ptr = nullptr;
+            auto wakeup_event = epoll_event{};
+            wakeup_event.events = EPOLLIN;
+            wakeup_event.data.ptr = &wakeup_;
+            if((server_socket != -1
+                && ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, server_socket, &server_event) == -1)
+               || ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_, &wakeup_event) == -1) {
+                auto const error = close_on_error(epoll_fd_);
+                epoll_fd_ = -1;
+                return error;
             }
+            auto events = std::vector<epoll_event>(default_events_limit);
+            while(!stopping_ && !drained()) {
+                auto const polled_count = ::epoll_wait(epoll_fd_, events.data(),
+                                                       int(events.size()), wait_timeout());
+                // Timers, tasks and callbacks may close connections having
+                // events later in the batch, their objects are not reused
+                // until the batch is dispatched
+                connections_.defer_recycling();
+                expire_timers(observer);
+                for(auto i = 0; i < polled_count; ++i) {
+                    if(events[i].data.ptr == &wakeup_) {
+                        handle_wakeup(observer);
+                        continue;
+                    }
+                    auto* connection = static_cast<tcp_connection*>(events[i].data.ptr);
+                    if(connection == nullptr) {
+                        accept_connections(server_socket, observer);
+                        continue;
+                    }
+                    if(connection->closed)
+                        continue;
+                    auto const flags = events[i].events;
+                    if(connection->shm) {
+                        serve_shm(observer, *connection, flags);
+                        continue;
+                    }
+                    if((flags & EPOLLOUT) && connection->tx_queued() != 0
+                       && !flush_connection(observer, *connection))
+                        continue;
+                    if(flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                        handle_data(observer, *connection);
+                }
+                serve_ready_shm(observer);
+                connections_.recycle_closed();
+            }
+            ::close(epoll_fd_);
+            epoll_fd_ = -1;
+            return {};
         }
 
 
-    private:
+        // Operation is kept in lower bits of submission user data,
+        // connection pointer in the rest
+        enum ring_operation : std::uint64_t {
+            ring_accept, ring_poll, ring_send, ring_cancel, ring_wakeup, ring_writable,
+            ring_receive, ring_provide
+        }; // ring_operation
 
-        static void
-        handle_socket(int& handled_count,
-                      tcp_server_observer& observer,
-                      descriptors& poll_ds,
-                      descriptors::iterator& it) {
-            if(!(it->revents & POLLIN))
-                return void(++it);
-            ++handled_count;
-            auto const tcp_response = observer.on_data_ready(it->fd);
-            switch(tcp_response) {
-                case tcp_response::close_connection:
-                    return close_connection(observer, poll_ds, it);
-                case tcp_response::await_next_data:
-                    return void(++it);
+        static constexpr auto ring_operation_mask = std::uint64_t{7};
+
+
+        static std::uint64_t
+        ring_data(ring_operation operation, tcp_connection* connection) noexcept {
+            return reinterpret_cast<std::uint64_t>(connection) | operation;
+        }
+
+
+        io_uring_sqe* ring_sqe() {
+            auto* sqe = ring_.next_sqe();
+            if(sqe != nullptr)
+                return sqe;
+            // Submission queue is full, flush it without waiting
+            (void)ring_.submit();
+            return ring_.next_sqe();
+        }
+
+
+        bool ring_accept_all(int server_socket) {
+            auto* sqe = ring_sqe();
+            if(sqe == nullptr)
+                return false;
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = server_socket;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            sqe->user_data = ring_data(ring_accept, nullptr);
+            ++ring_operations_;
+            return true;
+        }
+
+
+        bool ring_poll_wakeup() {
+            auto* sqe = ring_sqe();
+            if(sqe == nullptr)
+                return false;
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = wakeup_;
+            sqe->poll32_events = POLLIN;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->user_data = ring_data(ring_wakeup, nullptr);
+            ++ring_operations_;
+            return true;
+        }
+
+
+        bool ring_poll_connection(tcp_connection& connection) {
+            auto* sqe = ring_sqe();
+            if(sqe == nullptr)
+                return false;
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = connection.socket;
+            sqe->poll32_events = POLLIN | POLLRDHUP;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->user_data = ring_data(ring_poll, &connection);
+            ++connection.operations;
+            ++ring_operations_;
+            return true;
+        }
+
+
+        bool ring_receive_connection(tcp_connection& connection) {
+            auto* sqe = ring_sqe();
+            if(sqe == nullptr)
+                return false;
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = connection.socket;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = ring_buffers_.group();
+            sqe->user_data = ring_data(ring_receive, &connection);
+            connection.receiving = true;
+            ++connection.operations;
+            ++ring_operations_;
+            return true;
+        }
+
+
+        void ring_provide_buffers(unsigned id, unsigned count = 1u) {
+            auto* sqe = ring_sqe();
+            if(sqe == nullptr)
+                return;
+            ring_buffers_.provide(*sqe, id, count);
+            sqe->user_data = ring_data(ring_provide, nullptr);
+            ++ring_operations_;
+        }
+
+
+        // Multishot receive completes with ECANCELED and is submitted again
+        // when reading resumes
+        void ring_stop_receiving(tcp_connection& connection) {
+            auto* sqe = ring_sqe();
+            if(sqe == nullptr)
+                return;
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = ring_data(ring_receive, &connection);
+            sqe->user_data = ring_data(ring_cancel, &connection);
+            ++connection.operations;
+            ++ring_operations_;
+        }
+
+
+        // Bytes kept while reading was paused go first. Returns false if
+        // connection is closed
+        bool ring_resume_receiving(tcp_server_observer& observer, tcp_connection& connection) {
+            if(!connection.receiving && !ring_receive_connection(connection)) {
+                close_connection(observer, connection);
+                return false;
             }
+            if(!connection.read_pending)
+                return true;
+            connection.read_pending = false;
+            return receive_ring(observer, connection, {});
         }
 
 
-        static void
-        send_response(std::span<char> tx_buffer,
-                      tcp_server_observer& observer,
-                      descriptors& poll_ds,
-                      descriptors::iterator& it) {
-            auto* tx_data = tx_buffer.data();
-            auto tx_size= tx_buffer.size();
+        // Passes bytes of multishot receive to observer, output is held
+        // meanwhile as by receive(). Returns false if connection is closed
+        bool receive_ring(tcp_server_observer& observer,
+                          tcp_connection& connection,
+                          std::span<char const> bytes) {
+            if(options_.release_idle_buffers)
+                connections_.borrow_rx(connection);
+            if(connection.reading_paused) {
+                connection.read_pending = true;
+                if(keep_bytes(connection, bytes))
+                    return true;
+                close_connection(observer, connection);
+                return false;
+            }
+            connection.tx_held = true;
+            auto const response = pass_bytes(*receiving_, connection, bytes);
+            if(options_.release_idle_buffers)
+                connections_.return_rx(connection);
+            if(!release_output(connection.socket)
+               || response == tcp_response::close_connection)
+                return close_after_flush(observer, connection);
+            if(options_.socket.quick_ack && connection.address.sin_family == AF_INET)
+                (void)detail::set_option(connection.socket, IPPROTO_TCP, TCP_QUICKACK, 1);
+            return true;
+        }
+
+
+        // Bytes are passed in place if nothing is kept, otherwise they are
+        // kept too and passed after the kept ones. Bytes not consumed are kept
+        tcp_response pass_bytes(tcp_data_observer& observer,
+                                tcp_connection& connection,
+                                std::span<char const> bytes) {
+            auto& rx = connection.rx;
+            if(rx.empty() && !bytes.empty()) {
+                auto const consumed = observer.on_data(connection.socket, bytes);
+                if(consumed.response == tcp_response::close_connection)
+                    return tcp_response::close_connection;
+                bytes = bytes.subspan(std::min(consumed.bytes, bytes.size()));
+                return keep_bytes(connection, bytes)
+                    ? tcp_response::await_next_data
+                    : tcp_response::close_connection;
+            }
             for(;;) {
-                tx_result = ::write(it->fd, tx_data, tx_size);
-                if(tx_result == -1)
-                    return close_connection(observer, poll_ds, it);
-                tx_size -= tx_result;
-                if(tx_size == 0)
+                auto const space = rx.prepare(bytes.size(), options_.rx_buffer_limit,
+                                              options_.mirrored_rx_buffers);
+                auto const count = std::min(space.size(), bytes.size());
+                std::copy_n(bytes.data(), count, space.data());
+                rx.commit(count);
+                bytes = bytes.subspan(count);
+                auto const buffered = rx.size();
+                if(buffered == 0u)
+                    return tcp_response::await_next_data;
+                auto const consumed = observer.on_data(connection.socket, rx.data());
+                rx.consume(consumed.bytes);
+                if(consumed.response == tcp_response::close_connection)
+                    return tcp_response::close_connection;
+                if(bytes.empty())
+                    return tcp_response::await_next_data;
+                // Observer waits for more bytes than the limit allows
+                if(rx.size() == buffered)
+                    return tcp_response::close_connection;
+            }
+        }
+
+
+        // Returns false if bytes do not fit the limit
+        bool keep_bytes(tcp_connection& connection, std::span<char const> bytes) {
+            if(bytes.empty())
+                return true;
+            auto const space = connection.rx.prepare(bytes.size(), options_.rx_buffer_limit,
+                                                     options_.mirrored_rx_buffers);
+            if(space.size() < bytes.size())
+                return false;
+            std::memcpy(space.data(), bytes.data(), bytes.size());
+            connection.rx.commit(bytes.size());
+            return true;
+        }
+
+
+        // Segments appended while sending is in flight do not move bytes
+        // already gathered, so the output stays open for appending.
+        // io_uring has no sendfile, so file ranges are sent right away and
+        // writability of the socket is awaited when it is full
+        std::expected<void, std::error_code> ring_send_connection(tcp_connection& connection) {
+            while(connection.tx.front_file() != nullptr) {
+                auto const sent = connection.tx.send_file(connection.socket);
+                if(!sent)
+                    return std::unexpected(sent.error());
+                if(!*sent)
+                    return ring_poll_writable(connection);
+            }
+            if(connection.tx.empty())
+                return {};
+            auto* sqe = ring_sqe();
+            if(sqe == nullptr)
+                return std::unexpected(std::make_error_code(std::errc::no_buffer_space));
+            if(options_.release_idle_buffers)
+                connections_.borrow_iovecs(connection);
+            auto& iovecs = connection.tx_iovecs;
+            iovecs.resize(std::min(connection.tx.segments_count(), tcp_output::gather_limit));
+            connection.tx_message = msghdr{};
+            connection.tx_message.msg_iov = iovecs.data();
+            connection.tx_message.msg_iovlen = connection.tx.gather(iovecs);
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = connection.socket;
+            sqe->addr = reinterpret_cast<std::uint64_t>(&connection.tx_message);
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->user_data = ring_data(ring_send, &connection);
+            connection.tx_in_flight = true;
+            ++connection.operations;
+            ++ring_operations_;
+            return {};
+        }
+
+
+        std::expected<void, std::error_code> ring_poll_writable(tcp_connection& connection) {
+            auto* sqe = ring_sqe();
+            if(sqe == nullptr)
+                return std::unexpected(std::make_error_code(std::errc::no_buffer_space));
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = connection.socket;
+            sqe->poll32_events = POLLOUT;
+            sqe->user_data = ring_data(ring_writable, &connection);
+            connection.tx_in_flight = true;
+            ++connection.operations;
+            ++ring_operations_;
+            return {};
+        }
+
+
+        bool ring_cancel_connection(tcp_connection& connection) {
+            auto* sqe = ring_sqe();
+            if(sqe == nullptr)
+                return false;
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = connection.socket;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = ring_data(ring_cancel, &connection);
+            ++connection.operations;
+            ++ring_operations_;
+            return true;
+        }
+
+
+        std::expected<void, std::error_code>
+        run_ring(int server_socket, tcp_server_observer& observer) {
+            if(auto opened = ring_.open(default_ring_entries); !opened)
+                return opened;
+            ring_operations_ = 0;
+            ring_accept_paused_ = false;
+            if(receiving_ != nullptr && options_.ring_receive_buffers != 0u) {
+                ring_buffers_.open(0u, unsigned(std::min(options_.ring_receive_buffers,
+                                                         std::size_t{io_buffer_group::max_count})),
+                                   unsigned(options_.ring_receive_buffer_size));
+                ring_provide_buffers(0u, ring_buffers_.count());
+            }
+            if(server_socket != -1)
+                ring_accept_all(server_socket);
+            ring_poll_wakeup();
+            auto result = std::expected<void, std::error_code>{};
+            while(!stopping_ && !drained()) {
+                result = options_.busy_poll ? ring_.peek() : ring_.submit(1, wait_timeout());
+                if(!result)
                     break;
-                tx_data += tx_result;
+                expire_timers(observer);
+                auto const completed = ring_.complete([&](io_uring_cqe const& cqe) {
+                    handle_completion(observer, cqe);
+                });
+                if(completed == 0)
+                    resume_ring_accept(listener_);
             }
-            ++it;
+            stop_ring();
+            return result;
+        }
+
+
+        void stop_ring() {
+            // Cancel everything still in flight and wait for completions
+            // to be sure kernel does not touch send buffers anymore
+            if(auto* sqe = ring_sqe(); sqe != nullptr) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+                sqe->user_data = ring_data(ring_cancel, nullptr);
+                ++ring_operations_;
+            }
+            for(auto attempts = 0; ring_operations_ > 0 && attempts != 16; ++attempts) {
+                if(!ring_.submit(1, 100))
+                    break;
+                ring_.complete([&](io_uring_cqe const& cqe) {
+                    if(!(cqe.flags & IORING_CQE_F_MORE))
+                        --ring_operations_;
+                });
+            }
+            ring_.close();
+            ring_buffers_.close();
+        }
+
+
+        void handle_completion(tcp_server_observer& observer, io_uring_cqe const& cqe) {
+            auto const operation = ring_operation(cqe.user_data & ring_operation_mask);
+            auto* connection = reinterpret_cast<tcp_connection*>(
+                cqe.user_data & ~ring_operation_mask);
+            auto const finished = !(cqe.flags & IORING_CQE_F_MORE);
+            if(finished) {
+                --ring_operations_;
+                if(connection != nullptr)
+                    --connection->operations;
+            }
+            switch(operation) {
+                case ring_accept:
+                    // Out of descriptors without spare one, accepting is
+                    // resumed when some connection is closed or wait times out
+                    if((cqe.res == -EMFILE || cqe.res == -ENFILE)
+                       && (listener_ == -1 || !detail::drop_pending(listener_, spare_fd_))) {
+                        ring_accept_paused_ = finished;
+                        return;
+                    }
+                    // Listening socket is closed when server is draining
+                    if(finished && !stopping_ && listener_ != -1)
+                        ring_accept_all(listener_);
+                    if(cqe.res >= 0)
+                        accept_ring_connection(cqe.res, observer);
+                    return;
+                case ring_poll:
+                    if(connection->closing)
+                        return release_ring_connection(*connection);
+                    if(cqe.res < 0)
+                        return close_ring_connection(observer, *connection);
+                    if(handle_data(observer, *connection) && finished)
+                        ring_poll_connection(*connection);
+                    return;
+                case ring_send:
+                case ring_writable:
+                    connection->tx_in_flight = false;
+                    if(connection->closing)
+                        return release_ring_connection(*connection);
+                    if(cqe.res < 0)
+                        return close_ring_connection(observer, *connection);
+                    if(operation == ring_send)
+                        connection->tx.consume(std::size_t(cqe.res));
+                    if(!connection->tx.empty() && !ring_send_connection(*connection))
+                        return close_ring_connection(observer, *connection);
+                    on_flushed(observer, *connection);
+                    return;
+                case ring_receive: {
+                    if(finished)
+                        connection->receiving = false;
+                    auto const id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                    auto const bytes = cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)
+                        ? ring_buffers_.received(id, std::size_t(cqe.res))
+                        : std::span<char const>{};
+                    auto const closing = connection->closing;
+                    auto const open = !closing
+                        && (bytes.empty() || receive_ring(observer, *connection, bytes));
+                    // Kernel may fill buffer again as soon as it is given back
+                    if(!bytes.empty())
+                        ring_provide_buffers(id);
+                    if(closing)
+                        return release_ring_connection(*connection);
+                    if(!open)
+                        return;
+                    // Peer has closed connection or receiving has failed,
+                    // buffers run out or reading is paused otherwise
+                    if(cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS
+                                        && cqe.res != -ECANCELED))
+                        return void(close_after_flush(observer, *connection));
+                    if(finished && !connection->reading_paused
+                       && !ring_receive_connection(*connection))
+                        close_ring_connection(observer, *connection);
+                    return;
+                }
+                case ring_provide:
+                    return;
+                case ring_cancel:
+                    // Multishot receive is cancelled by pausing too
+                    if(connection != nullptr && connection->closing)
+                        release_ring_connection(*connection);
+                    return;
+                case ring_wakeup:
+                    if(finished && !stopping_)
+                        ring_poll_wakeup();
+                    handle_wakeup(observer);
+                    return;
+            }
+        }
+
+
+        void accept_ring_connection(int client_socket, tcp_server_observer& observer) {
+            auto client_addr = sockaddr_in{};
+            auto client_addr_size = socklen_t(sizeof(client_addr));
+            ::getpeername(client_socket,
+                          reinterpret_cast<sockaddr*>(&client_addr),
+                          &client_addr_size);
+            detail::clear_unix_peer(client_addr);
+            open_connection(observer, client_socket, client_addr);
+        }
+
+
+        void close_ring_connection(tcp_server_observer& observer,
+                                   tcp_connection& connection) {
+            if(connection.closing)
+                return;
+            connection.closing = true;
+            timers_.cancel(connection.timer);
+            timers_.cancel(connection.tx_timer);
+            connections_count_.fetch_sub(1, std::memory_order_relaxed);
+            observer.on_disconnected(connection.socket);
+            // Descriptor is closed when the last operation on it is completed
+            ring_cancel_connection(connection);
+            release_ring_connection(connection);
+        }
+
+
+        void release_ring_connection(tcp_connection& connection) {
+            if(connection.operations != 0)
+                return;
+            auto const client_socket = connection.socket;
+            ::close(client_socket);
+            connections_.close(client_socket);
+            resume_ring_accept(listener_);
         }
 
 
-        static void
-        close_connection(tcp_server_observer& observer,
-                         descriptors& poll_ds,
-                         descriptors::iterator& it) {
-            ::close(it->fd);
-            observer.on_disconnected(it->fd);
-            it = poll_ds.erase(it);
+        void resume_ring_accept(int server_socket) {
+            if(!ring_accept_paused_ || stopping_ || server_socket == -1)
+                return;
+            ring_accept_paused_ = false;
+            ring_accept_all(server_socket);
         }
 
     }; // tcp_server
@@ -0,0 +1,228 @@
+// This file is part of inter library
+// Copyright 2023 Andrei Ilin
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+
+namespace inter {
+
+
+    // Intrusive timer, owner identifies itself by tag
+    struct timer_node {
+        timer_node* next{nullptr};
+        timer_node** pprev{nullptr};
+        std::uint64_t expiry{0u};
+        std::uint16_t slot{0u};
+        std::uintptr_t tag{0u};
+
+        bool armed() const noexcept {
+            return pprev != nullptr;
+        }
+    }; // timer_node
+
+
+    // Hierarchical timing wheel (Varghese and Lauck): timers are armed and
+    // cancelled in O(1) and move to lower levels as their expiry gets closer.
+    // Every level has 64 slots, so the longest timeout is 2^24 ticks
+    class timer_wheel {
+    public:
+
+        using clock = std::chrono::steady_clock;
+        using duration = std::chrono::milliseconds;
+        using size_type = std::size_t;
+
+    private:
+
+        static constexpr auto slot_bits = 6;
+        static constexpr auto slots_count = std::uint64_t{1} << slot_bits;
+        static constexpr auto slot_mask = slots_count - 1;
+        static constexpr auto levels_count = 4;
+        static constexpr auto max_ticks = (std::uint64_t{1} << (slot_bits * levels_count)) - 1;
+
+        struct level {
+            std::array<timer_node*, slots_count> slots{};
+            // Bit per non-empty slot
+            std::uint64_t occupied{0u};
+        }; // level
+
+        std::array<level, levels_count> levels_{};
+        duration resolution_;
+        clock::time_point origin_;
+        std::uint64_t now_{0u};
+        size_type size_{0u};
+
+    public:
+
+        explicit timer_wheel(duration resolution = duration{10},
+                             clock::time_point now = clock::now()) noexcept
+            : resolution_{resolution.count() > 0 ? resolution : duration{1}}, origin_{now} {
+        }
+
+        // Armed timers point into the wheel
+        timer_wheel(timer_wheel const&) = delete;
+        timer_wheel& operator = (timer_wheel const&) = delete;
+
+
+        size_type size() const noexcept {
+            return size_;
+        }
+
+
+        bool empty() const noexcept {
+            return size_ == 0u;
+        }
+
+
+        duration resolution() const noexcept {
+            return resolution_;
+        }
+
+
+        // Re-arms timer if it is armed already, expiry is rounded up to
+        // the wheel resolution
+        void arm(timer_node& node, duration timeout) noexcept {
+            cancel(node);
+            auto const ticks = timeout.count() > 0
+                ? std::uint64_t((timeout + resolution_ - duration{1}) / resolution_)
+                : std::uint64_t{1};
+            node.expiry = now_ + std::clamp(ticks, std::uint64_t{1}, max_ticks);
+            insert(node);
+            ++size_;
+        }
+
+
+        void cancel(timer_node& node) noexcept {
+            if(!node.armed())
+                return;
+            unlink(node);
+            --size_;
+        }
+
+
+        // Time until the next timer could expire, nullopt if none is armed.
+        // Timers of upper levels are counted from their move to lower one
+        std::optional<duration> next_timeout() const noexcept {
+            if(empty())
+                return std::nullopt;
+            auto ticks = max_ticks;
+            for(auto l = 0; l != levels_count; ++l) {
+                auto const occupied = levels_[l].occupied;
+                if(occupied == 0u)
+                    continue;
+                auto const shift = slot_bits * l;
+                auto const current = (now_ >> shift) & slot_mask;
+                // Slots following the current one, the current one is the last
+                auto const ahead = std::rotr(occupied, int((current + 1) & slot_mask));
+                auto const blocks = std::uint64_t(std::countr_zero(ahead)) + 1;
+                auto const block_ticks = std::uint64_t{1} << shift;
+                auto const passed = now_ & (block_ticks - 1);
+                ticks = std::min(ticks, blocks * block_ticks - passed);
+            }
+            return resolution_ * ticks;
+        }
+
+
+        // Calls 'expired' for every timer expired by 'now'. Timer is not
+        // armed when 'expired' is called, so it can be armed again
+        template<typename F> void advance(clock::time_point now, F&& expired) {
+            auto const target = std::uint64_t((now - origin_) / resolution_);
+            if(empty()) {
+                now_ = std::max(now_, target);
+                return;
+            }
+            while(now_ < target) {
+                ++now_;
+                cascade();
+                auto& slot = levels_[0].slots[now_ & slot_mask];
+                auto* list = take(slot, 0, now_ & slot_mask);
+                expire(list, expired);
+            }
+        }
+
+    private:
+
+        void insert(timer_node& node) noexcept {
+            auto const delta = node.expiry - now_;
+            auto l = 0;
+            while(l != levels_count - 1 && delta >= (std::uint64_t{1} << (slot_bits * (l + 1))))
+                ++l;
+            auto const index = (node.expiry >> (slot_bits * l)) & slot_mask;
+            auto& head = levels_[l].slots[index];
+            node.next = head;
+            if(head != nullptr)
+                head->pprev = &node.next;
+            head = &node;
+            node.pprev = &head;
+            node.slot = std::uint16_t(l * slots_count + index);
+            levels_[l].occupied |= std::uint64_t{1} << index;
+        }
+
+
+        void unlink(timer_node& node) noexcept {
+            *node.pprev = node.next;
+            if(node.next != nullptr)
+                node.next->pprev = node.pprev;
+            node.next = nullptr;
+            node.pprev = nullptr;
+            auto& l = levels_[node.slot / slots_count];
+            auto const index = node.slot % slots_count;
+            if(l.slots[index] == nullptr)
+                l.occupied &= ~(std::uint64_t{1} << index);
+        }
+
+
+        // Detaches list of the slot, its timers stay linked to each other
+        timer_node* take(timer_node*& slot, int l, std::uint64_t index) noexcept {
+            auto* list = slot;
+            slot = nullptr;
+            levels_[l].occupied &= ~(std::uint64_t{1} << index);
+            return list;
+        }
+
+
+        // Moves timers of upper levels whose block begins now
+        void cascade() noexcept {
+            for(auto l = 1; l != levels_count; ++l) {
+                auto const shift = slot_bits * l;
+                if((now_ & ((std::uint64_t{1} << shift) - 1)) != 0u)
+                    return;
+                auto const index = (now_ >> shift) & slot_mask;
+                auto* list = take(levels_[l].slots[index], l, index);
+                while(list != nullptr) {
+                    auto& node = *list;
+                    list = node.next;
+                    insert(node);
+                }
+            }
+        }
+
+
+        template<typename F> void expire(timer_node* list, F& expired) {
+            // Detached list head keeps the rest cancellable from 'expired'
+            auto* head = list;
+            if(head != nullptr)
+                head->pprev = &head;
+            while(head != nullptr) {
+                auto& node = *head;
+                head = node.next;
+                if(head != nullptr)
+                    head->pprev = &head;
+                node.next = nullptr;
+                node.pprev = nullptr;
+                --size_;
+                expired(node);
+            }
+        }
+
+    }; // timer_wheel
+
+} // namespace inter
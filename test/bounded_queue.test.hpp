@@ -0,0 +1,74 @@
+#pragma once
+
+#include "doctest.h"
+
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <inter/bounded_queue.hpp>
+
+
+TEST_SUITE("bounded_queue") {
+
+    SCENARIO("queue keeps order and refuses pushes when full") {
+        auto queue = inter::bounded_queue<int>{5};
+        CHECK(queue.capacity() == 8u);
+        CHECK_FALSE(queue.try_pop());
+        // Cells are reused many times around the ring
+        for(auto round = 0; round != 3; ++round) {
+            for(auto i = 0; i != 8; ++i)
+                CHECK(queue.try_push(round * 8 + i));
+            CHECK_FALSE(queue.try_push(-1));
+            for(auto i = 0; i != 8; ++i) {
+                auto const value = queue.try_pop();
+                REQUIRE(value);
+                CHECK(*value == round * 8 + i);
+            }
+            CHECK_FALSE(queue.try_pop());
+        }
+    }
+
+    SCENARIO("popped values are released") {
+        auto queue = inter::bounded_queue<std::shared_ptr<int>>{2};
+        auto const value = std::make_shared<int>(1);
+        REQUIRE(queue.try_push(value));
+        CHECK(value.use_count() == 2);
+        CHECK(queue.try_pop());
+        CHECK(value.use_count() == 1);
+    }
+
+    SCENARIO("values of many producers come in order of each producer") {
+        constexpr auto producers_count = 4;
+        constexpr auto values_count = 100000;
+        auto queue = inter::bounded_queue<std::pair<int, int>>{64};
+        auto producers = std::vector<std::thread>{};
+        for(auto p = 0; p != producers_count; ++p)
+            producers.emplace_back([&queue, p] {
+                for(auto i = 0; i != values_count; )
+                    if(queue.try_push(p, i))
+                        ++i;
+                    else
+                        std::this_thread::yield();
+            });
+        auto next = std::vector<int>(producers_count, 0);
+        auto received = 0;
+        auto ordered = true;
+        while(received != producers_count * values_count) {
+            auto const value = queue.try_pop();
+            if(!value) {
+                std::this_thread::yield();
+                continue;
+            }
+            ordered = ordered && value->second == next[value->first];
+            next[value->first] = value->second + 1;
+            ++received;
+        }
+        for(auto& producer: producers)
+            producer.join();
+        CHECK(ordered);
+        CHECK_FALSE(queue.try_pop());
+    }
+
+}
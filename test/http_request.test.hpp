@@ -0,0 +1,309 @@
+#pragma once
+
+#include "doctest.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include <inter/http_parser.hpp>
+#include <inter/http_request.hpp>
+#include <inter/http_scan.hpp>
+
+
+namespace {
+
+    // Allocations of the calling thread
+    thread_local std::size_t allocations = 0;
+
+
+    // Page followed by inaccessible one, bytes placed at its end are the
+    // last readable ones
+    class guarded_page {
+        std::size_t size_{std::size_t(::sysconf(_SC_PAGESIZE))};
+        char* memory_{nullptr};
+
+    public:
+
+        guarded_page() {
+            auto* memory = ::mmap(nullptr, size_ * 2, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            REQUIRE(memory != MAP_FAILED);
+            memory_ = static_cast<char*>(memory);
+            REQUIRE(::mprotect(memory_ + size_, size_, PROT_NONE) == 0);
+        }
+
+        guarded_page(guarded_page const&) = delete;
+        guarded_page& operator = (guarded_page const&) = delete;
+        ~guarded_page() { ::munmap(memory_, size_ * 2); }
+
+        std::string_view place(std::string_view bytes) noexcept {
+            auto* at = memory_ + size_ - bytes.size();
+            std::memcpy(at, bytes.data(), bytes.size());
+            return {at, bytes.size()};
+        }
+    }; // guarded_page
+
+
+    void check_same(inter::http_request const& got, inter::http_request const& expected) {
+        CHECK(got.method == expected.method);
+        CHECK(got.uri == expected.uri);
+        CHECK(got.major_version == expected.major_version);
+        CHECK(got.minor_version == expected.minor_version);
+        for(auto i = 0; i != inter::http_header::count; ++i)
+            CHECK(got.headers[i] == expected.headers[i]);
+        REQUIRE(got.dynamic_headers.size() == expected.dynamic_headers.size());
+        for(auto i = std::size_t{0}; i != got.dynamic_headers.size(); ++i) {
+            CHECK(got.dynamic_headers.begin()[i].name == expected.dynamic_headers.begin()[i].name);
+            CHECK(got.dynamic_headers.begin()[i].value == expected.dynamic_headers.begin()[i].value);
+        }
+    }
+
+} // namespace
+
+
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    ++allocations;
+    if(auto* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc{};
+}
+
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+
+TEST_SUITE("http_request") {
+
+    constexpr auto browser_request = std::string_view{
+        "GET /index.html?lang=en HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+        "Sec-Fetch-Site: none\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-User: ?1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: en-US,en;q=0.9\r\n"
+        "Cookie: session=0123456789abcdef\r\n"
+        "\r\n"
+    };
+
+    SCENARIO("browser request is parsed with no allocation") {
+        auto const before = allocations;
+        auto const request = inter::parse_request(browser_request);
+        auto const allocated = allocations - before;
+        REQUIRE(request);
+        CHECK(allocated == 0);
+        CHECK(request->headers[inter::http_header::host] == "www.example.com");
+        CHECK(request->dynamic_headers.size() == 13);
+        CHECK(request->dynamic_headers.value("Accept-Language") == "en-US,en;q=0.9");
+        CHECK(request->dynamic_headers.value("Cookie") == "session=0123456789abcdef");
+        CHECK(request->dynamic_headers.value("Referer").empty());
+    }
+
+    SCENARIO("parser extracts the next request with no allocation") {
+        auto parser = inter::http_parser{};
+        auto request = inter::http_request{};
+        REQUIRE(parser.parse(browser_request).status == inter::http_parse_status::complete);
+        parser.extract(browser_request, request);
+        parser.reset();
+        auto const before = allocations;
+        auto const parsed = parser.parse(browser_request);
+        parser.extract(browser_request, request);
+        auto const allocated = allocations - before;
+        REQUIRE(parsed.status == inter::http_parse_status::complete);
+        CHECK(parsed.consumed == browser_request.size());
+        CHECK(allocated == 0);
+        CHECK(request.dynamic_headers.value("Sec-Fetch-Dest") == "document");
+    }
+
+    SCENARIO("headers past inline count are kept") {
+        constexpr std::string_view names[] = {
+            "X-00", "X-01", "X-02", "X-03", "X-04", "X-05", "X-06", "X-07", "X-08", "X-09",
+            "X-10", "X-11", "X-12", "X-13", "X-14", "X-15", "X-16", "X-17", "X-18", "X-19"
+        };
+        static_assert(std::size(names) > inter::dynamic_headers::inline_count);
+        auto headers = inter::dynamic_headers{};
+        for(auto const name: names)
+            headers.append(name, name);
+        CHECK(headers.size() == std::size(names));
+        for(auto const name: names)
+            CHECK(headers.value(name) == name);
+        headers.clear();
+        CHECK(headers.empty());
+        CHECK(headers.begin() == headers.end());
+    }
+
+    SCENARIO("the last of repeated headers is found") {
+        auto headers = inter::dynamic_headers{};
+        headers.append("Accept", "text/html");
+        headers.append("Accept", "text/plain");
+        CHECK(headers.size() == 2);
+        CHECK(headers.value("Accept") == "text/plain");
+    }
+
+    SCENARIO("vector kernels find the same positions as scalar ones") {
+        using namespace inter::detail;
+        // Class characters mixed with delimiters, zero and bytes above 0x7f
+        constexpr auto alphabet = std::string_view{"aZ09-_/%?=.:; \r\n\0\x7f\x80\xff", 21};
+        char const* const classes[] = {"method", "uri", "header"};
+        char_class const* const sets[] = {&method_class, &uri_class, &header_class};
+        auto random = std::minstd_rand{42};
+        // Readable bytes past every input, so padded bounds hold too
+        char buffer[256 + inter::http_request_padding];
+        auto const level = detect_scan_level();
+        for(auto round = 0; round != 2000; ++round) {
+            auto const size = std::size_t(random() % 200);
+            auto const offset = std::size_t(random() % 32);
+            // Long runs of class characters cross whole blocks
+            auto const run = std::size_t(random() % 8) == 0 ? 1u : 64u;
+            for(auto i = std::size_t{0}; i != sizeof(buffer); ++i)
+                buffer[i] = random() % run == 0 ? alphabet[random() % alphabet.size()] : 'a';
+            auto const* const text = buffer + offset;
+            for(auto const padding: {std::size_t{0}, inter::http_request_padding}) {
+                auto const bounds = scan_bounds{text + size, padding};
+                auto const eol = find_eol_scalar(text, bounds);
+#if defined(INTER_HTTP_SCAN_X86)
+                if(level >= scan_level::sse42)
+                    REQUIRE(find_eol_sse42(text, bounds) == eol);
+                if(level >= scan_level::avx2)
+                    REQUIRE(find_eol_avx2(text, bounds) == eol);
+#endif
+                for(auto i = 0; i != 3; ++i) {
+                    CAPTURE(classes[i]);
+                    auto const skipped = skip_class_scalar(text, bounds, *sets[i]);
+#if defined(INTER_HTTP_SCAN_X86)
+                    if(level >= scan_level::sse42)
+                        REQUIRE(skip_class_sse42(text, bounds, *sets[i]) == skipped);
+                    if(level >= scan_level::avx2)
+                        REQUIRE(skip_class_avx2(text, bounds, *sets[i]) == skipped);
+#endif
+                }
+            }
+        }
+        (void)level;
+    }
+
+    SCENARIO("request ending right before inaccessible page is parsed") {
+        auto page = guarded_page{};
+        auto const expected = inter::parse_request(browser_request);
+        REQUIRE(expected);
+        // Every prefix ends at the page end, so starts and block offsets
+        // vary; all but the whole head are incomplete
+        for(auto size = std::size_t{0}; size <= browser_request.size(); ++size) {
+            CAPTURE(size);
+            auto const input = page.place(browser_request.substr(0, size));
+            auto const request = inter::parse_request(input);
+            CHECK(request.has_value() == (size == browser_request.size()));
+            auto parser = inter::http_parser{};
+            auto const parsed = parser.parse(input);
+            CHECK((parsed.status == inter::http_parse_status::complete)
+                  == (size == browser_request.size()));
+        }
+        // Long values and malformed lines run up to the page end too
+        auto const cookie = "GET / HTTP/1.1\r\nCookie: " + std::string(3000, 'c');
+        CHECK_FALSE(inter::parse_request(page.place(cookie)));
+        CHECK_FALSE(inter::parse_request(page.place(std::string(3000, 'G'))));
+        CHECK_FALSE(inter::parse_request(page.place("GET /" + std::string(3000, 'u'))));
+        auto const request = inter::parse_request(page.place(browser_request));
+        REQUIRE(request);
+        check_same(*request, *expected);
+    }
+
+    SCENARIO("unpadded request is parsed without loads past its end") {
+        // Heap block of the exact size, ASan reports any byte read after it
+        for(auto size = std::size_t{0}; size <= browser_request.size(); ++size) {
+            CAPTURE(size);
+            auto const block = std::make_unique<char[]>(size);
+            std::memcpy(block.get(), browser_request.data(), size);
+            auto const input = std::string_view{block.get(), size};
+            CHECK(inter::parse_request(input).has_value() == (size == browser_request.size()));
+            auto parser = inter::http_parser{};
+            CHECK((parser.parse(input).status == inter::http_parse_status::complete)
+                  == (size == browser_request.size()));
+        }
+    }
+
+    SCENARIO("bounded input is parsed without bytes after its end") {
+        // Bytes after the end would complete the head
+        auto const buffer = std::string{browser_request} + std::string(64, '\n');
+        for(auto size = std::size_t{0}; size < browser_request.size(); ++size) {
+            CAPTURE(size);
+            CHECK_FALSE(inter::parse_request(std::string_view{buffer.data(), size}));
+            CHECK_FALSE(inter::parse_request(std::string_view{buffer.data(), size}, true));
+        }
+        auto const whole = std::span<char const>{buffer.data(), browser_request.size()};
+        auto const request = inter::parse_request(whole, true);
+        REQUIRE(request);
+        check_same(*request, *inter::parse_request(browser_request));
+        // Zero inside input is not taken for its end
+        auto with_zero = std::string{"GET / HTTP/1.1\r\nHost: a"};
+        with_zero += '\0';
+        with_zero += "b\r\n\r\n";
+        CHECK_FALSE(inter::parse_request(std::string_view{with_zero}));
+        CHECK_FALSE(inter::parse_request(std::string_view{"GET / HTTP/1.1\r\n\r"}));
+        auto const minimal = inter::parse_request(std::string_view{"GET / HTTP/1.1\n\n"});
+        REQUIRE(minimal);
+        CHECK(minimal->uri == "/");
+    }
+
+    SCENARIO("head parsed as it arrives is the same as parsed at once") {
+        auto const expected = inter::parse_request(browser_request);
+        REQUIRE(expected);
+        for(auto const chunk: {std::size_t{1}, std::size_t{7}, std::size_t{64}, browser_request.size()}) {
+            CAPTURE(chunk);
+            auto parser = inter::http_parser{};
+            auto received = std::string{};
+            auto parsed = inter::http_parse_result{inter::http_parse_status::need_more};
+            for(auto at = std::size_t{0}; at < browser_request.size(); at += chunk) {
+                REQUIRE(parsed.status == inter::http_parse_status::need_more);
+                // Received bytes move to another buffer between calls
+                received = std::string{received} + std::string{browser_request.substr(at, chunk)};
+                parsed = parser.parse(received);
+            }
+            REQUIRE(parsed.status == inter::http_parse_status::complete);
+            CHECK(parsed.consumed == browser_request.size());
+            auto request = inter::http_request{};
+            parser.extract(received, request);
+            check_same(request, *expected);
+        }
+        // Malformed line is an error as soon as it is complete
+        auto parser = inter::http_parser{};
+        constexpr auto malformed = std::string_view{"GET / HTTP/1.1\r\nHost www.example.com\r\n"};
+        CHECK(parser.parse(malformed.substr(0, malformed.size() - 1)).status
+              == inter::http_parse_status::need_more);
+        auto const failed = parser.parse(malformed);
+        CHECK(failed.status == inter::http_parse_status::error);
+        CHECK(failed.error == inter::http_error::bad_request);
+        CHECK_FALSE(inter::parse_request(std::string{malformed} + "\r\n"));
+        // Head over the limit is refused before it completes
+        auto limited = inter::http_parser{64};
+        auto const large = limited.parse(browser_request.substr(0, 100));
+        CHECK(large.status == inter::http_parse_status::error);
+        CHECK(large.error == inter::http_error::header_fields_too_large);
+    }
+
+}
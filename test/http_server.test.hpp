@@ -0,0 +1,375 @@
+#pragma once
+
+#include "doctest.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <inter/http_server.hpp>
+
+#include "http_request.test.hpp"
+#include "sockets.test.hpp"
+
+
+namespace {
+
+    // Answers every request with its URI
+    struct uri_observer: inter::http::http_server_observer {
+        inter::http::http_server* server{nullptr};
+        std::atomic<int> requests{0};
+
+        void on_request(int client_socket, inter::http_request const& request) override {
+            ++requests;
+            (void)server->send_response(client_socket, 200, "text/plain",
+                                        std::span<char const>{request.uri});
+        }
+    }; // uri_observer
+
+
+    // Server on its own thread listening at Unix domain socket
+    struct running_http_server {
+        std::string path;
+        inter::http::http_server server;
+        std::thread serving;
+
+        running_http_server(std::string const& name,
+                            inter::http::http_server_options const& options,
+                            inter::http::http_server_observer& observer)
+            : path{"/tmp/inter-" + name + "-" + std::to_string(::getpid()) + ".sock"},
+              server{options} {
+            serving = std::thread{[this, &observer] {
+                CHECK(server.listen_unix(path.c_str(), observer));
+            }};
+        }
+
+        ~running_http_server() {
+            server.stop();
+            if(serving.joinable())
+                serving.join();
+            ::unlink(path.c_str());
+        }
+
+        // Allocations made so far on the reactor thread
+        std::size_t reactor_allocations() {
+            auto counted = std::atomic<std::size_t>{0u};
+            auto done = std::atomic<bool>{false};
+            while(!server.post([&] {
+                counted = allocations;
+                done = true;
+            }))
+                std::this_thread::yield();
+            while(!done)
+                std::this_thread::yield();
+            return counted;
+        }
+
+
+        int dial() const {
+            auto client = -1;
+            for(auto i = 0; i != 1000 && client == -1; ++i)
+                if(client = dial_unix(path); client == -1)
+                    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            return client;
+        }
+    }; // running_http_server
+
+
+    struct http_response {
+        std::string head;
+        std::string body;
+    }; // http_response
+
+
+    // Complete responses at the start of 'input', their bytes are erased
+    std::vector<http_response> take_responses(std::string& input) {
+        auto responses = std::vector<http_response>{};
+        auto taken = std::size_t{0};
+        for(;;) {
+            auto const head_end = input.find("\r\n\r\n", taken);
+            if(head_end == std::string::npos)
+                break;
+            auto const head = std::string_view{input}.substr(taken, head_end + 4 - taken);
+            auto length = std::size_t{0};
+            if(auto const at = head.find("Content-Length: "); at != std::string_view::npos)
+                std::from_chars(head.data() + at + 16, head.data() + head.size(), length);
+            if(input.size() - head_end - 4 < length)
+                break;
+            responses.push_back({std::string{head}, input.substr(head_end + 4, length)});
+            taken = head_end + 4 + length;
+        }
+        input.erase(0, taken);
+        return responses;
+    }
+
+
+    // Reads until 'count' responses come, peer closes or nothing comes
+    // for a second; 'closed' tells if peer has closed connection
+    std::vector<http_response> read_responses(int client, std::size_t count,
+                                              bool* closed = nullptr) {
+        auto responses = std::vector<http_response>{};
+        auto received = std::string{};
+        char buffer[4096];
+        if(closed != nullptr)
+            *closed = false;
+        while(responses.size() < count) {
+            auto descriptor = pollfd{.fd = client, .events = POLLIN, .revents = 0};
+            if(::poll(&descriptor, 1, 1000) != 1)
+                break;
+            auto const read = ::read(client, buffer, sizeof(buffer));
+            if(read <= 0) {
+                if(closed != nullptr)
+                    *closed = true;
+                break;
+            }
+            received.append(buffer, std::size_t(read));
+            for(auto& response: take_responses(received))
+                responses.push_back(std::move(response));
+        }
+        return responses;
+    }
+
+
+    // Tells if peer closes connection within a second, bytes sent before
+    // are skipped
+    bool closed_by_peer(int client) {
+        char buffer[4096];
+        for(;;) {
+            auto descriptor = pollfd{.fd = client, .events = POLLIN, .revents = 0};
+            if(::poll(&descriptor, 1, 1000) != 1)
+                return false;
+            if(::read(client, buffer, sizeof(buffer)) <= 0)
+                return true;
+        }
+    }
+
+
+    // Bytes of one read, waits for them a second at most
+    std::string read_once(int client) {
+        char buffer[4096];
+        auto descriptor = pollfd{.fd = client, .events = POLLIN, .revents = 0};
+        if(::poll(&descriptor, 1, 1000) != 1)
+            return {};
+        auto const read = ::read(client, buffer, sizeof(buffer));
+        return read > 0 ? std::string(buffer, std::size_t(read)) : std::string{};
+    }
+
+
+    std::string get(std::string_view uri, std::string_view fields = {}) {
+        auto request = std::string{"GET "};
+        request += uri;
+        request += " HTTP/1.1\r\nHost: localhost\r\n";
+        request += fields;
+        request += "\r\n";
+        return request;
+    }
+
+
+    bool write_all(int client, std::string_view bytes) {
+        while(!bytes.empty()) {
+            auto const written = ::write(client, bytes.data(), bytes.size());
+            if(written <= 0)
+                return false;
+            bytes.remove_prefix(std::size_t(written));
+        }
+        return true;
+    }
+
+} // namespace
+
+
+TEST_SUITE("http_server") {
+
+    SCENARIO("idle session frees no memory it needs for the next request") {
+        auto options = inter::http::http_server_options{};
+        options.tcp.engine = inter::tcp_engine::epoll;
+        options.tcp.release_idle_buffers = true;
+        auto observer = uri_observer{};
+        auto running = running_http_server{"allocations", options, observer};
+        observer.server = &running.server;
+        auto const client = running.dial();
+        REQUIRE(client != -1);
+        // Headers parser does not know are kept by the session
+        auto unknown = std::string{};
+        for(auto i = 0; i != 8; ++i)
+            unknown += "X-Trace-" + std::to_string(i) + ": 1\r\n";
+        auto const plain = get("/");
+        auto const traced = get("/", unknown);
+        // Every request finds the session idle and its buffers released
+        auto const allocations = [&](std::string const& request) {
+            auto const before = running.reactor_allocations();
+            for(auto i = 0; i != 32; ++i) {
+                REQUIRE(write_all(client, request));
+                REQUIRE(read_responses(client, 1).size() == 1u);
+            }
+            return running.reactor_allocations() - before;
+        };
+        (void)allocations(traced);
+        auto const for_plain = allocations(plain);
+        auto const for_traced = allocations(traced);
+        CHECK(for_traced == for_plain);
+        ::close(client);
+    }
+
+
+    SCENARIO("pipelined requests are answered in order with one write") {
+        for(auto const engine: {inter::tcp_engine::poll, inter::tcp_engine::epoll,
+                                inter::tcp_engine::io_uring}) {
+            CAPTURE(int(engine));
+            auto observer = uri_observer{};
+            auto running = running_http_server{"pipeline", {.tcp = {.engine = engine}}, observer};
+            observer.server = &running.server;
+            auto const client = running.dial();
+            REQUIRE(client != -1);
+            // The last request is split, its first half comes with the others
+            auto const split = get("/4", "Accept: */*\r\n");
+            auto const half = split.size() / 2;
+            REQUIRE(write_all(client, get("/1") + get("/2") + get("/3") + split.substr(0, half)));
+            auto received = read_once(client);
+            auto responses = take_responses(received);
+            REQUIRE(responses.size() == 3u);
+            CHECK(received.empty());
+            CHECK(responses[0].body == "/1");
+            CHECK(responses[1].body == "/2");
+            CHECK(responses[2].body == "/3");
+            REQUIRE(write_all(client, std::string_view{split}.substr(half)));
+            responses = read_responses(client, 1);
+            REQUIRE(responses.size() == 1u);
+            CHECK(responses[0].body == "/4");
+            // Requests after the closing one are not answered
+            REQUIRE(write_all(client, get("/5") + get("/6", "Connection: close\r\n") + get("/7")));
+            auto closed = false;
+            responses = read_responses(client, 3, &closed);
+            CHECK(closed);
+            REQUIRE(responses.size() == 2u);
+            CHECK(responses[0].body == "/5");
+            CHECK(responses[0].head.find("Connection: close") == std::string::npos);
+            CHECK(responses[1].body == "/6");
+            CHECK(responses[1].head.find("Connection: close") != std::string::npos);
+            CHECK(observer.requests == 6);
+            ::close(client);
+        }
+    }
+
+
+    SCENARIO("draining server answers requests in flight and closes idle connections") {
+        // Request for '/later' is answered by a task posted afterwards
+        struct : uri_observer {
+            std::atomic<int> waiting{-1};
+
+            void on_request(int client_socket, inter::http_request const& request) override {
+                if(request.uri == "/later")
+                    waiting = client_socket;
+                else
+                    uri_observer::on_request(client_socket, request);
+            }
+        } observer;
+        auto running = running_http_server{"drain", {.tcp = {.engine = inter::tcp_engine::epoll}},
+                                           observer};
+        observer.server = &running.server;
+        auto const idle = running.dial();
+        auto const answering = running.dial();
+        REQUIRE(idle != -1);
+        REQUIRE(answering != -1);
+        REQUIRE(write_all(idle, get("/now")));
+        REQUIRE(read_responses(idle, 1).size() == 1u);
+        REQUIRE(write_all(answering, get("/later")));
+        for(auto i = 0; i != 1000 && observer.waiting == -1; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        REQUIRE(observer.waiting != -1);
+        running.server.drain(std::chrono::seconds{5});
+        // Keep-alive connection has nothing to finish
+        CHECK(closed_by_peer(idle));
+        CHECK(dial_unix(running.path) == -1);
+        CHECK(read_once(answering).empty());
+        CHECK(running.server.post([&] {
+            auto const body = std::string_view{"/later"};
+            (void)running.server.send_response(observer.waiting, 200, "text/plain",
+                                               std::span<char const>{body});
+        }));
+        auto closed = false;
+        auto const responses = read_responses(answering, 2, &closed);
+        REQUIRE(responses.size() == 1u);
+        CHECK(responses[0].body == "/later");
+        CHECK(responses[0].head.find("Connection: close") != std::string::npos);
+        CHECK(closed);
+        // Server stops once the last connection is closed
+        running.serving.join();
+        ::close(idle);
+        ::close(answering);
+    }
+
+
+    SCENARIO("slow client is answered with 408 and idle one is closed silently") {
+        auto observer = uri_observer{};
+        auto running = running_http_server{"timeouts", {
+            .tcp = {.engine = inter::tcp_engine::epoll},
+            .header_read_timeout = std::chrono::milliseconds{100},
+            .body_read_timeout = std::chrono::milliseconds{100},
+            .keep_alive_timeout = std::chrono::milliseconds{100}
+        }, observer};
+        observer.server = &running.server;
+        auto const silent = running.dial();
+        auto const slow_head = running.dial();
+        auto const slow_body = running.dial();
+        auto const kept_alive = running.dial();
+        for(auto const client: {silent, slow_head, slow_body, kept_alive})
+            REQUIRE(client != -1);
+        REQUIRE(write_all(slow_head, "GET /head HTTP/1.1\r\nHost: local"));
+        REQUIRE(write_all(slow_body, get("/body", "Content-Length: 10\r\n") + "01234"));
+        REQUIRE(write_all(kept_alive, get("/kept")));
+        for(auto const client: {slow_head, slow_body}) {
+            auto closed = false;
+            auto const responses = read_responses(client, 2, &closed);
+            REQUIRE(responses.size() == 1u);
+            CHECK(responses[0].head.starts_with("HTTP/1.1 408"));
+            CHECK(responses[0].head.find("Connection: close") != std::string::npos);
+            CHECK(closed);
+        }
+        auto closed = false;
+        auto const responses = read_responses(kept_alive, 2, &closed);
+        REQUIRE(responses.size() == 1u);
+        CHECK(responses[0].body == "/kept");
+        CHECK(closed);
+        CHECK(read_responses(silent, 1, &closed).empty());
+        CHECK(closed);
+        CHECK(observer.requests == 1);
+        for(auto const client: {silent, slow_head, slow_body, kept_alive})
+            ::close(client);
+    }
+
+
+    SCENARIO("request head larger than the limit is answered with 431") {
+        auto observer = uri_observer{};
+        auto running = running_http_server{"head-limit", {
+            .tcp = {.engine = inter::tcp_engine::epoll},
+            .max_head_size = 1024
+        }, observer};
+        observer.server = &running.server;
+        auto const client = running.dial();
+        REQUIRE(client != -1);
+        auto const fitting = get("/fits", "X-Padding: " + std::string(512, 'x') + "\r\n");
+        REQUIRE(write_all(client, fitting));
+        auto responses = read_responses(client, 1);
+        REQUIRE(responses.size() == 1u);
+        CHECK(responses[0].body == "/fits");
+        REQUIRE(write_all(client, get("/large", "X-Padding: " + std::string(1024, 'x') + "\r\n")));
+        auto closed = false;
+        responses = read_responses(client, 2, &closed);
+        REQUIRE(responses.size() == 1u);
+        CHECK(responses[0].head.starts_with("HTTP/1.1 431"));
+        CHECK(closed);
+        CHECK(observer.requests == 1);
+        ::close(client);
+    }
+
+}
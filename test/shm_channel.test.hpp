@@ -0,0 +1,312 @@
+#pragma once
+
+#include "doctest.h"
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <inter/http_server.hpp>
+#include <inter/shm_channel.hpp>
+
+
+namespace {
+
+    // Ring over private memory, both sides are played by the test
+    struct local_ring {
+        static constexpr auto capacity = std::size_t{64};
+
+        inter::detail::shm_cursors cursors;
+        std::unique_ptr<char[]> data{new char[capacity]};
+        inter::shm_ring producer{cursors, data.get(), capacity};
+        inter::shm_ring consumer{cursors, data.get(), capacity};
+    }; // local_ring
+
+
+    inter::shm_channel connect_shm(std::string const& path) {
+        for(auto i = 0; i != 1000; ++i) {
+            if(auto channel = inter::shm_channel::connect(path.c_str()); channel)
+                return std::move(*channel);
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        return {};
+    }
+
+
+    // Reads until 'marker' came 'count' times or nothing comes for a second
+    std::string read_shm(inter::shm_channel& channel, std::string_view marker, int count) {
+        auto received = std::string{};
+        auto found = 0;
+        char buffer[256];
+        while(found < count) {
+            if(auto const read = channel.read(buffer); read != 0u) {
+                auto const from = received.size() < marker.size()
+                    ? 0u : received.size() - marker.size() + 1;
+                received.append(buffer, read);
+                for(auto at = received.find(marker, from); at != std::string::npos;
+                    at = received.find(marker, at + 1))
+                    ++found;
+                continue;
+            }
+            if(!channel.wait(inter::shm_waiting_data, 1000))
+                break;
+        }
+        return received;
+    }
+
+
+    struct hello_observer: inter::http::http_server_observer {
+        inter::http::http_server* server{nullptr};
+
+        void on_request(int client_socket, inter::http_request const&) override {
+            auto const body = std::string_view{"hello"};
+            (void)server->send_response(client_socket, 200, "text/plain",
+                                        std::span<char const>{body});
+        }
+    }; // hello_observer
+
+
+    // Passes region with a valid header, but sealed with 'seals' only
+    void offer_region(int socket, unsigned seals) {
+        auto const capacity = std::uint64_t{4096};
+        auto const size = sizeof(inter::detail::shm_header) + 2 * capacity;
+        auto const region = ::memfd_create("inter-shm-test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        CHECK(::ftruncate(region, off_t(size)) != -1);
+        auto* const mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, region, 0);
+        CHECK(mapped != MAP_FAILED);
+        if(mapped != MAP_FAILED) {
+            new (mapped) inter::detail::shm_header{capacity};
+            ::munmap(mapped, size);
+        }
+        CHECK((seals == 0u || ::fcntl(region, F_ADD_SEALS, seals) != -1));
+        int const descriptors[3] = {region, ::eventfd(0, EFD_CLOEXEC), ::eventfd(0, EFD_CLOEXEC)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(descriptors))] = {};
+        auto payload = iovec{.iov_base = const_cast<std::uint64_t*>(&capacity),
+                             .iov_len = sizeof(capacity)};
+        auto message = msghdr{};
+        message.msg_iov = &payload;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        auto* cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(descriptors));
+        std::memcpy(CMSG_DATA(cmsg), descriptors, sizeof(descriptors));
+        CHECK(::sendmsg(socket, &message, MSG_NOSIGNAL) != -1);
+        for(auto const descriptor: descriptors)
+            ::close(descriptor);
+    }
+
+
+    // The first bytes stall the reactor for a while
+    struct counting_observer: inter::tcp_data_observer {
+        std::atomic<std::size_t> received{0u};
+        std::atomic<int> disconnected{0};
+
+        bool on_connected(int, sockaddr_in const&) override { return true; }
+        void on_disconnected(int) override { ++disconnected; }
+
+        inter::tcp_consumed on_data(int, std::span<char const> data) override {
+            auto const first = received == 0u;
+            received += data.size();
+            if(first)
+                std::this_thread::sleep_for(std::chrono::milliseconds{50});
+            return {data.size()};
+        }
+    }; // counting_observer
+
+} // namespace
+
+
+TEST_SUITE("shm_channel") {
+
+    SCENARIO("ring passes bytes in order across its end") {
+        auto ring = local_ring{};
+        auto written = std::size_t{0};
+        auto read = std::size_t{0};
+        char chunk[40];
+        while(read < 1000) {
+            for(auto i = std::size_t{0}; i != sizeof(chunk); ++i)
+                chunk[i] = char(written + i);
+            written += ring.producer.write(chunk);
+            CHECK(ring.producer.writable() == local_ring::capacity - (written - read));
+            auto const count = ring.consumer.read(chunk);
+            for(auto i = std::size_t{0}; i != count; ++i)
+                REQUIRE(chunk[i] == char(read + i));
+            read += count;
+        }
+        char more[local_ring::capacity + 1] = {};
+        CHECK(ring.producer.write(more) == local_ring::capacity - (written - read));
+        CHECK(ring.producer.writable() == 0u);
+        CHECK_FALSE(ring.producer.corrupted());
+        CHECK_FALSE(ring.consumer.corrupted());
+    }
+
+
+    SCENARIO("cursor moved by peer out of range breaks the ring") {
+        auto ring = local_ring{};
+        char bytes[16] = {};
+        REQUIRE(ring.producer.write(bytes) == sizeof(bytes));
+        // Tail too far after head
+        ring.cursors.tail = sizeof(bytes) + local_ring::capacity;
+        CHECK(ring.consumer.readable() == 0u);
+        CHECK(ring.consumer.read(bytes) == 0u);
+        CHECK(ring.consumer.corrupted());
+
+        auto other = local_ring{};
+        REQUIRE(other.producer.write(bytes) == sizeof(bytes));
+        // Head after tail
+        other.cursors.head = sizeof(bytes) + 1;
+        CHECK(other.producer.write(bytes) == 0u);
+        CHECK(other.producer.corrupted());
+    }
+
+
+    SCENARIO("region that peer can resize is refused") {
+        auto const path = "@inter-shm-seals-" + std::to_string(::getpid());
+        auto const listener = inter::tcp_server::open_shm_listener(path.c_str());
+        REQUIRE(listener);
+        for(auto const seals: {0u, unsigned(F_SEAL_SHRINK | F_SEAL_GROW),
+                               unsigned(F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)}) {
+            auto offering = std::thread{[&] {
+                auto socket = -1;
+                for(auto i = 0; i != 1000 && socket == -1; ++i) {
+                    socket = ::accept4(*listener, nullptr, nullptr, SOCK_CLOEXEC);
+                    if(socket == -1)
+                        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                }
+                CHECK(socket != -1);
+                if(socket == -1)
+                    return;
+                offer_region(socket, seals);
+                ::close(socket);
+            }};
+            auto const channel = inter::shm_channel::connect(path.c_str());
+            offering.join();
+            if(seals == unsigned(F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+                CHECK(channel);
+            } else {
+                REQUIRE_FALSE(channel);
+                CHECK(channel.error() == std::errc::bad_message);
+            }
+        }
+        ::close(*listener);
+    }
+
+
+    SCENARIO("bytes written right before hanging up are served") {
+        auto const path = "/tmp/inter-shm-" + std::to_string(::getpid()) + ".sock";
+        auto server = inter::tcp_server{inter::tcp_engine::epoll};
+        auto observer = counting_observer{};
+        auto serving = std::thread{[&] {
+            CHECK(server.listen_shm(path.c_str(), observer));
+        }};
+        auto channel = connect_shm(path);
+        CHECK(channel.socket() != -1);
+        if(channel.socket() != -1) {
+            auto const bytes = std::string(500, 'x');
+            CHECK(channel.write(bytes) == bytes.size());
+            for(auto i = 0; i != 1000 && observer.received == 0u; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            // Hang-up comes in the same turn as the bytes
+            CHECK(channel.write(bytes) == bytes.size());
+            // Process is gone without closing its side of the channel
+            ::shutdown(channel.socket(), SHUT_RDWR);
+        }
+        for(auto i = 0; i != 1000 && observer.disconnected == 0; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        server.stop();
+        serving.join();
+        CHECK(observer.disconnected == 1);
+        CHECK(observer.received == 1000u);
+        ::unlink(path.c_str());
+    }
+
+
+    SCENARIO("peer gone while observer waits for more bytes is closed") {
+        auto const path = "@inter-shm-waiting-" + std::to_string(::getpid());
+        auto server = inter::tcp_server{inter::tcp_engine::epoll};
+        struct : inter::tcp_data_observer {
+            std::atomic<int> calls{0};
+            std::atomic<int> disconnected{0};
+
+            bool on_connected(int, sockaddr_in const&) override { return true; }
+            void on_disconnected(int) override { ++disconnected; }
+            inter::tcp_consumed on_data(int, std::span<char const>) override {
+                ++calls;
+                return {0u};
+            }
+        } observer;
+        auto serving = std::thread{[&] {
+            CHECK(server.listen_shm(path.c_str(), observer, 4096));
+        }};
+        auto channel = connect_shm(path);
+        CHECK(channel.socket() != -1);
+        auto const bytes = std::string(100, 'x');
+        CHECK(channel.write(bytes) == bytes.size());
+        channel.close();
+        for(auto i = 0; i != 1000 && observer.disconnected == 0; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        server.stop();
+        serving.join();
+        CHECK(observer.disconnected == 1);
+        CHECK(observer.calls <= 2);
+    }
+
+
+    SCENARIO("http server answers over shared memory") {
+        auto const path = "/tmp/inter-shm-http-" + std::to_string(::getpid()) + ".sock";
+        auto server = inter::http::http_server{inter::tcp_engine::epoll};
+        auto observer = hello_observer{};
+        observer.server = &server;
+        auto serving = std::thread{[&] {
+            CHECK(server.listen_shm(path.c_str(), observer, 4096));
+        }};
+        auto channel = connect_shm(path);
+        CHECK(channel.socket() != -1);
+        if(channel.socket() != -1) {
+            // Pipelined requests are answered in order
+            auto const request = std::string_view{"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"};
+            auto requests = std::string{};
+            for(auto i = 0; i != 3; ++i)
+                requests += request;
+            CHECK(channel.write(requests) == requests.size());
+            auto const response = read_shm(channel, "hello", 3);
+            CHECK(response.starts_with("HTTP/1.1 200"));
+            CHECK(response.ends_with("hello"));
+        }
+        channel.close();
+        server.stop();
+        serving.join();
+        ::unlink(path.c_str());
+    }
+
+
+    SCENARIO("shared memory is not served by other engines") {
+        auto server = inter::tcp_server{inter::tcp_engine::poll};
+        struct : inter::tcp_data_observer {
+            bool on_connected(int, sockaddr_in const&) override { return true; }
+            void on_disconnected(int) override { }
+            inter::tcp_consumed on_data(int, std::span<char const> data) override {
+                return {data.size()};
+            }
+        } observer;
+        auto const served = server.listen_shm("@inter-shm-poll", observer);
+        REQUIRE_FALSE(served);
+        CHECK(served.error() == std::errc::operation_not_supported);
+    }
+
+}
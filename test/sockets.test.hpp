@@ -2,12 +2,663 @@
 
 #include "doctest.h"
 
-#include <inter/sockets.hpp>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <inter/tcp_acceptor.hpp>
+#include <inter/tcp_reactors.hpp>
+#include <inter/tcp_server.hpp>
+
+
+namespace {
+
+    struct idle_observer: inter::tcp_server_observer {
+        bool on_connected(int, sockaddr_in const&) override { return true; }
+        void on_disconnected(int) override { }
+        inter::tcp_response on_data_ready(int) override {
+            return inter::tcp_response::close_connection;
+        }
+    }; // idle_observer
+
+
+    // Connection reporting data first closes all the others
+    struct closing_observer: inter::tcp_server_observer {
+        inter::tcp_server& server;
+        std::vector<int> open;
+        int disconnected{0};
+        int stale{0};
+
+        explicit closing_observer(inter::tcp_server& server) noexcept: server{server} { }
+
+        bool on_connected(int client_socket, sockaddr_in const&) override {
+            open.push_back(client_socket);
+            return true;
+        }
+
+        void on_disconnected(int client_socket) override {
+            ++disconnected;
+            std::erase(open, client_socket);
+        }
+
+        inter::tcp_response on_data_ready(int client_socket) override {
+            if(std::ranges::find(open, client_socket) == open.end())
+                ++stale;
+            char buffer[64];
+            while(::read(client_socket, buffer, sizeof(buffer)) > 0) { }
+            auto const others = open;
+            for(auto const other: others)
+                if(other != client_socket)
+                    server.close(other);
+            return inter::tcp_response::await_next_data;
+        }
+    }; // closing_observer
+
+
+    // Echoes every complete 8-byte record, the rest waits for more bytes
+    struct record_observer: inter::tcp_data_observer {
+        inter::tcp_server& server;
+        std::atomic<int> disconnected{0};
+
+        explicit record_observer(inter::tcp_server& server) noexcept: server{server} { }
+
+        bool on_connected(int, sockaddr_in const&) override { return true; }
+        void on_disconnected(int) override { ++disconnected; }
+
+        inter::tcp_consumed on_data(int client_socket, std::span<char const> data) override {
+            auto const complete = data.size() - data.size() % 8;
+            if(complete != 0u && !server.send(client_socket, data.first(complete)))
+                return {0, inter::tcp_response::close_connection};
+            return {complete};
+        }
+    }; // record_observer
+
+
+    // Waits for a head that never ends
+    struct hoarding_observer: inter::tcp_data_observer {
+        std::atomic<int> disconnected{0};
+
+        bool on_connected(int, sockaddr_in const&) override { return true; }
+        void on_disconnected(int) override { ++disconnected; }
+
+        inter::tcp_consumed on_data(int, std::span<char const>) override {
+            return {0};
+        }
+    }; // hoarding_observer
+
+
+    // Reads back options of accepted sockets
+    struct tuned_observer: inter::tcp_server_observer {
+        std::atomic<bool> connected{false};
+        int no_delay{-1};
+        int receive_buffer{-1};
+        int send_buffer{-1};
+        int not_sent_low_watermark{-1};
+        int receive_low_watermark{-1};
+
+        static int option(int socket, int level, int name) {
+            auto value = -1;
+            auto size = socklen_t{sizeof(value)};
+            return ::getsockopt(socket, level, name, &value, &size) == 0 ? value : -1;
+        }
+
+        bool on_connected(int client_socket, sockaddr_in const&) override {
+            no_delay = option(client_socket, IPPROTO_TCP, TCP_NODELAY);
+            receive_buffer = option(client_socket, SOL_SOCKET, SO_RCVBUF);
+            send_buffer = option(client_socket, SOL_SOCKET, SO_SNDBUF);
+            not_sent_low_watermark = option(client_socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+            receive_low_watermark = option(client_socket, SOL_SOCKET, SO_RCVLOWAT);
+            connected = true;
+            return true;
+        }
+
+        void on_disconnected(int) override { }
+
+        inter::tcp_response on_data_ready(int) override {
+            return inter::tcp_response::close_connection;
+        }
+    }; // tuned_observer
+
+
+    int dial_unix(std::string const& path) {
+        auto address = sockaddr_un{};
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        auto const client = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(::connect(client, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) == -1) {
+            ::close(client);
+            return -1;
+        }
+        return client;
+    }
+
+} // namespace
+
 
 TEST_SUITE("sockets") {
-    
-    SCENARIO("") {
-        
+
+    SCENARIO("unix listener replaces stale socket and keeps other files") {
+        auto const path = "/tmp/inter-test-" + std::to_string(::getpid()) + ".sock";
+        auto const file = ::open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+        REQUIRE(file != -1);
+        ::close(file);
+        CHECK_FALSE(inter::tcp_server::open_unix_listener(path.c_str()));
+        struct stat status{};
+        REQUIRE(::lstat(path.c_str(), &status) == 0);
+        CHECK(S_ISREG(status.st_mode));
+        ::unlink(path.c_str());
+
+        auto const first = inter::tcp_server::open_unix_listener(path.c_str());
+        REQUIRE(first);
+        ::close(*first);
+        auto const second = inter::tcp_server::open_unix_listener(path.c_str());
+        REQUIRE(second);
+        ::close(*second);
+        ::unlink(path.c_str());
+    }
+
+
+    SCENARIO("listeners are not exported by stopped reactor") {
+        auto reactors = inter::tcp_reactors{inter::tcp_engine::epoll};
+        REQUIRE(reactors.start(0, 2, [](std::size_t) {
+            return std::make_unique<idle_observer>();
+        }));
+        reactors.server(1).stop();
+        for(auto i = 0; i != 1000 && reactors.server(1).post([] { }); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        int channel[2];
+        REQUIRE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, channel) == 0);
+        auto const started = std::chrono::steady_clock::now();
+        auto const exported = reactors.export_listeners(channel[0]);
+        CHECK_FALSE(exported);
+        CHECK(std::chrono::steady_clock::now() - started < std::chrono::seconds{1});
+        reactors.stop();
+        CHECK(reactors.join());
+        ::close(channel[0]);
+        ::close(channel[1]);
     }
-    
+
+
+    SCENARIO("listener handed over to another server refuses no connections") {
+        auto const path = "/tmp/inter-handoff-" + std::to_string(::getpid()) + ".sock";
+        struct counting_observer: record_observer {
+            std::atomic<int> connected{0};
+
+            using record_observer::record_observer;
+
+            bool on_connected(int, sockaddr_in const&) override {
+                ++connected;
+                return true;
+            }
+        }; // counting_observer
+        auto predecessor = inter::tcp_server{inter::tcp_engine::epoll};
+        auto predecessor_observer = counting_observer{predecessor};
+        auto predecessor_serving = std::thread{[&] {
+            CHECK(predecessor.listen_unix(path.c_str(), predecessor_observer));
+        }};
+        auto client = -1;
+        for(auto i = 0; i != 1000 && client == -1; ++i)
+            if(client = dial_unix(path); client == -1)
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        REQUIRE(client != -1);
+        ::close(client);
+        // Clients keep connecting while listener changes hands
+        auto dialing = std::atomic<bool>{true};
+        auto refused = std::atomic<int>{0};
+        auto clients = std::thread{[&] {
+            while(dialing) {
+                auto const client = dial_unix(path);
+                if(client == -1) {
+                    ++refused;
+                    continue;
+                }
+                (void)::send(client, "01234567", 8, MSG_NOSIGNAL);
+                char echo[8];
+                (void)::read(client, echo, sizeof(echo));
+                ::close(client);
+            }
+        }};
+        int channel[2];
+        REQUIRE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, channel) == 0);
+        // Exported by reactor thread: 1 if sent, -1 if failed
+        auto exported = std::atomic<int>{0};
+        CHECK(predecessor.post([&] {
+            exported = predecessor.export_listener(channel[0]) ? 1 : -1;
+        }));
+        auto const listeners = inter::receive_listeners(channel[1]);
+        REQUIRE(listeners);
+        REQUIRE(listeners->size() == 1u);
+        for(auto i = 0; i != 1000 && exported == 0; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        CHECK(exported == 1);
+        auto successor = inter::tcp_server{inter::tcp_engine::epoll};
+        auto successor_observer = counting_observer{successor};
+        auto successor_serving = std::thread{[&] {
+            CHECK(successor.listen_inherited(listeners->front(), successor_observer));
+        }};
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        predecessor.drain(std::chrono::milliseconds{1000});
+        predecessor_serving.join();
+        auto const handed_over = successor_observer.connected.load();
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        dialing = false;
+        clients.join();
+        CHECK(refused == 0);
+        CHECK(predecessor_observer.connected > 1);
+        // Connections keep coming to successor alone
+        CHECK(successor_observer.connected > handed_over);
+        successor.stop();
+        successor_serving.join();
+        ::close(channel[0]);
+        ::close(channel[1]);
+        ::unlink(path.c_str());
+    }
+
+
+    SCENARIO("draining acceptor hands over connections waiting in the queue") {
+        auto const path = "/tmp/inter-acceptor-" + std::to_string(::getpid()) + ".sock";
+        auto acceptor = inter::tcp_acceptor{inter::tcp_server_options{
+            .engine = inter::tcp_engine::epoll,
+            .accept_batch = 1
+        }};
+        REQUIRE(acceptor.start_unix(path.c_str(), 2, [](std::size_t) {
+            return std::make_unique<idle_observer>();
+        }, 256));
+        auto clients = std::vector<int>{};
+        for(auto i = 0; i != 200; ++i)
+            clients.push_back(dial_unix(path));
+        acceptor.drain(std::chrono::milliseconds{1000});
+        CHECK(acceptor.join());
+        auto reset = 0;
+        for(auto const client: clients) {
+            REQUIRE(client != -1);
+            char byte;
+            if(::read(client, &byte, 1) == -1)
+                ++reset;
+            ::close(client);
+        }
+        CHECK(reset == 0);
+        ::unlink(path.c_str());
+    }
+
+
+    SCENARIO("acceptor waiting for connections stops at once") {
+        auto const path = "/tmp/inter-acceptor-" + std::to_string(::getpid()) + ".sock";
+        auto acceptor = inter::tcp_acceptor{inter::tcp_engine::epoll};
+        REQUIRE(acceptor.start_unix(path.c_str(), 1, [](std::size_t) {
+            return std::make_unique<idle_observer>();
+        }));
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        auto const started = std::chrono::steady_clock::now();
+        acceptor.drain(std::chrono::milliseconds{1000});
+        CHECK(acceptor.join());
+        CHECK(std::chrono::steady_clock::now() - started < std::chrono::milliseconds{500});
+        ::unlink(path.c_str());
+    }
+
+
+    SCENARIO("connection closed in the middle of epoll batch gets no more events") {
+        auto const path = "/tmp/inter-batch-" + std::to_string(::getpid()) + ".sock";
+        auto server = inter::tcp_server{inter::tcp_engine::epoll};
+        auto observer = closing_observer{server};
+        auto serving = std::thread{[&] {
+            CHECK(server.listen_unix(path.c_str(), observer));
+        }};
+        auto clients = std::vector<int>{};
+        for(auto i = 0; i != 1000 && clients.size() != 8u; ++i) {
+            if(auto const client = dial_unix(path); client != -1)
+                clients.push_back(client);
+            else
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        for(auto i = 0; i != 1000 && server.connections_count() != clients.size(); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        CHECK(clients.size() == 8u);
+        CHECK(server.connections_count() == clients.size());
+        // Reactor is busy while all the clients send, so their events
+        // are reported together
+        CHECK(server.post([] {
+            std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        }));
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        for(auto const client: clients)
+            CHECK(::write(client, "x", 1) == 1);
+        for(auto i = 0; i != 1000 && server.connections_count() != 1u; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        CHECK(server.connections_count() == 1u);
+        server.stop();
+        serving.join();
+        CHECK(observer.stale == 0);
+        CHECK(observer.disconnected == int(clients.size()));
+        for(auto const client: clients)
+            ::close(client);
+        ::unlink(path.c_str());
+    }
+
+
+    SCENARIO("io_uring passes received bytes in order through few small buffers") {
+        auto const path = "/tmp/inter-recv-" + std::to_string(::getpid()) + ".sock";
+        // Records straddle buffers, buffers run out and reading is paused
+        // by queued echo
+        auto server = inter::tcp_server{inter::tcp_server_options{
+            .engine = inter::tcp_engine::io_uring,
+            .tx_high_watermark = 4096,
+            .tx_low_watermark = 1024,
+            .ring_receive_buffers = 4,
+            .ring_receive_buffer_size = 100
+        }};
+        auto observer = record_observer{server};
+        auto serving = std::thread{[&] {
+            CHECK(server.listen_unix(path.c_str(), observer));
+        }};
+        auto client = -1;
+        for(auto i = 0; i != 1000 && client == -1; ++i)
+            if(client = dial_unix(path); client == -1)
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        REQUIRE(client != -1);
+        auto sent = std::string{};
+        for(auto i = 0; i != 32768; ++i) {
+            char record[9];
+            std::snprintf(record, sizeof(record), "%08d", i);
+            sent.append(record, 8);
+        }
+        auto writing = std::thread{[&] {
+            for(auto at = std::size_t{0}; at < sent.size(); ) {
+                auto const written = ::write(client, sent.data() + at,
+                                             std::min(sent.size() - at, std::size_t{333}));
+                if(written <= 0)
+                    break;
+                at += std::size_t(written);
+            }
+        }};
+        auto received = std::string{};
+        char buffer[4096];
+        while(received.size() < sent.size()) {
+            auto const count = ::read(client, buffer, sizeof(buffer));
+            if(count <= 0)
+                break;
+            received.append(buffer, std::size_t(count));
+        }
+        writing.join();
+        CHECK(received.size() == sent.size());
+        CHECK(received == sent);
+        ::close(client);
+        for(auto i = 0; i != 1000 && observer.disconnected == 0; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        CHECK(observer.disconnected == 1);
+        server.stop();
+        serving.join();
+        ::unlink(path.c_str());
+    }
+
+
+    SCENARIO("posted tasks run on reactor thread in order") {
+        for(auto const engine: {inter::tcp_engine::poll, inter::tcp_engine::epoll,
+                                inter::tcp_engine::io_uring}) {
+            CAPTURE(int(engine));
+            auto const path = "/tmp/inter-post-" + std::to_string(::getpid()) + ".sock";
+            auto server = inter::tcp_server{inter::tcp_server_options{
+                .engine = engine,
+                .tasks_limit = 16
+            }};
+            CHECK_FALSE(server.post([] { }));
+            auto observer = idle_observer{};
+            auto reactor = std::thread::id{};
+            auto serving = std::thread{[&] {
+                reactor = std::this_thread::get_id();
+                CHECK(server.listen_unix(path.c_str(), observer));
+            }};
+            for(auto i = 0; i != 1000 && !server.post([] { }); ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            // Full queue refuses tasks until reactor runs some of them
+            auto done = std::vector<int>{};
+            auto on_reactor = true;
+            for(auto i = 0; i != 1000; ) {
+                if(server.post([&, i] {
+                    on_reactor = on_reactor && std::this_thread::get_id() == reactor;
+                    done.push_back(i);
+                })) {
+                    ++i;
+                    continue;
+                }
+                std::this_thread::yield();
+            }
+            auto finished = std::atomic<bool>{false};
+            for(auto i = 0; i != 1000 && !server.post([&] { finished = true; }); ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            for(auto i = 0; i != 1000 && !finished; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            server.stop();
+            serving.join();
+            CHECK_FALSE(server.post([] { }));
+            REQUIRE(done.size() == 1000u);
+            CHECK(std::ranges::is_sorted(done));
+            CHECK(on_reactor);
+            ::unlink(path.c_str());
+        }
+    }
+
+
+    SCENARIO("echo to client reading late is queued and flushed in order") {
+        for(auto const engine: {inter::tcp_engine::poll, inter::tcp_engine::epoll,
+                                inter::tcp_engine::io_uring}) {
+            CAPTURE(int(engine));
+            auto const path = "/tmp/inter-late-" + std::to_string(::getpid()) + ".sock";
+            // Queued echo pauses reading of requests, client is not blocked
+            // while it writes since the rest waits in its socket
+            auto server = inter::tcp_server{inter::tcp_server_options{
+                .engine = engine,
+                .tx_high_watermark = 64 * 1024,
+                .tx_low_watermark = 16 * 1024
+            }};
+            auto observer = record_observer{server};
+            auto serving = std::thread{[&] {
+                CHECK(server.listen_unix(path.c_str(), observer));
+            }};
+            auto client = -1;
+            for(auto i = 0; i != 1000 && client == -1; ++i)
+                if(client = dial_unix(path); client == -1)
+                    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            REQUIRE(client != -1);
+            auto sent = std::string{};
+            for(auto i = 0; i != 128 * 1024; ++i) {
+                char record[9];
+                std::snprintf(record, sizeof(record), "%08d", i);
+                sent.append(record, 8);
+            }
+            auto writing = std::thread{[&] {
+                for(auto at = std::size_t{0}; at < sent.size(); ) {
+                    auto const written = ::write(client, sent.data() + at, sent.size() - at);
+                    if(written <= 0)
+                        break;
+                    at += std::size_t(written);
+                }
+            }};
+            std::this_thread::sleep_for(std::chrono::milliseconds{200});
+            CHECK(server.connections_count() == 1u);
+            auto received = std::string{};
+            char buffer[65536];
+            while(received.size() < sent.size()) {
+                auto const count = ::read(client, buffer, sizeof(buffer));
+                if(count <= 0)
+                    break;
+                received.append(buffer, std::size_t(count));
+            }
+            writing.join();
+            CHECK(received == sent);
+            CHECK(observer.disconnected == 0);
+            ::close(client);
+            server.stop();
+            serving.join();
+            ::unlink(path.c_str());
+        }
+    }
+
+
+    SCENARIO("acceptor spreads connections over workers which serve them") {
+        auto const path = "/tmp/inter-spread-" + std::to_string(::getpid()) + ".sock";
+        auto acceptor = inter::tcp_acceptor{inter::tcp_engine::epoll};
+        REQUIRE(acceptor.start_unix(path.c_str(), 3, [&acceptor](std::size_t i) {
+            return std::make_unique<record_observer>(acceptor.workers().server(i));
+        }));
+        auto clients = std::vector<int>{};
+        for(auto i = 0; i != 9; ++i)
+            clients.push_back(dial_unix(path));
+        auto const served = [&] {
+            auto count = std::size_t{0};
+            for(auto i = std::size_t{0}; i != 3; ++i)
+                count += acceptor.workers().server(i).connections_count();
+            return count;
+        };
+        for(auto i = 0; i != 1000 && served() != clients.size(); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        // Round robin gives every worker the same share
+        for(auto i = std::size_t{0}; i != 3; ++i)
+            CHECK(acceptor.workers().server(i).connections_count() == 3u);
+        for(auto const client: clients) {
+            REQUIRE(client != -1);
+            CHECK(::write(client, "01234567", 8) == 8);
+            char echo[8];
+            CHECK(::read(client, echo, sizeof(echo)) == 8);
+            CHECK(std::string_view{echo, sizeof(echo)} == "01234567");
+            ::close(client);
+        }
+        acceptor.stop();
+        CHECK(acceptor.join());
+        ::unlink(path.c_str());
+    }
+
+
+    SCENARIO("busy polling reactor serves connections and tasks") {
+        for(auto const engine: {inter::tcp_engine::poll, inter::tcp_engine::epoll,
+                                inter::tcp_engine::io_uring}) {
+            CAPTURE(int(engine));
+            auto const path = "/tmp/inter-busy-" + std::to_string(::getpid()) + ".sock";
+            auto server = inter::tcp_server{inter::tcp_server_options{
+                .engine = engine,
+                .busy_poll = true
+            }};
+            auto observer = record_observer{server};
+            auto serving = std::thread{[&] {
+                CHECK(server.listen_unix(path.c_str(), observer));
+            }};
+            auto client = -1;
+            for(auto i = 0; i != 1000 && client == -1; ++i)
+                if(client = dial_unix(path); client == -1)
+                    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            REQUIRE(client != -1);
+            auto echoed = 0;
+            for(auto i = 0; i != 100; ++i) {
+                char echo[8];
+                if(::write(client, "01234567", 8) == 8 && ::read(client, echo, 8) == 8)
+                    ++echoed;
+            }
+            CHECK(echoed == 100);
+            auto done = std::atomic<bool>{false};
+            CHECK(server.post([&] { done = true; }));
+            for(auto i = 0; i != 1000 && !done; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            CHECK(done);
+            ::close(client);
+            for(auto i = 0; i != 1000 && observer.disconnected == 0; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            CHECK(observer.disconnected == 1);
+            server.stop();
+            serving.join();
+            ::unlink(path.c_str());
+        }
+    }
+
+
+    SCENARIO("connection is closed when unconsumed bytes reach the limit") {
+        for(auto const engine: {inter::tcp_engine::poll, inter::tcp_engine::epoll,
+                                inter::tcp_engine::io_uring}) {
+            CAPTURE(int(engine));
+            auto const path = "/tmp/inter-hoard-" + std::to_string(::getpid()) + ".sock";
+            auto server = inter::tcp_server{inter::tcp_server_options{
+                .engine = engine,
+                .rx_buffer_limit = 64 * 1024
+            }};
+            auto observer = hoarding_observer{};
+            auto serving = std::thread{[&] {
+                CHECK(server.listen_unix(path.c_str(), observer));
+            }};
+            auto client = -1;
+            for(auto i = 0; i != 1000 && client == -1; ++i)
+                if(client = dial_unix(path); client == -1)
+                    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            REQUIRE(client != -1);
+            auto const bytes = std::string(1024, 'x');
+            for(auto i = 0; i != 1024 && observer.disconnected == 0; ++i)
+                if(::send(client, bytes.data(), bytes.size(), MSG_NOSIGNAL) <= 0)
+                    break;
+            for(auto i = 0; i != 1000 && observer.disconnected == 0; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            CHECK(observer.disconnected == 1);
+            CHECK(server.connections_count() == 0u);
+            ::close(client);
+            server.stop();
+            serving.join();
+            ::unlink(path.c_str());
+        }
+    }
+
+
+    SCENARIO("accepted TCP sockets are tuned by socket options") {
+        auto const options = inter::tcp_socket_options{
+            .bind_address = "127.0.0.1",
+            .no_delay = true,
+            .fastopen_queue = 16,
+            .receive_buffer = 16 * 1024,
+            .send_buffer = 16 * 1024,
+            .not_sent_low_watermark = 8 * 1024,
+            .receive_low_watermark = 4
+        };
+        auto const listener = inter::tcp_server::open_listener(0, options);
+        REQUIRE(listener);
+        CHECK(tuned_observer::option(*listener, IPPROTO_TCP, TCP_FASTOPEN) == 16);
+        auto address = sockaddr_in{};
+        auto length = socklen_t{sizeof(address)};
+        REQUIRE(::getsockname(*listener, reinterpret_cast<sockaddr*>(&address), &length) == 0);
+        auto server = inter::tcp_server{inter::tcp_server_options{
+            .engine = inter::tcp_engine::epoll,
+            .socket = options
+        }};
+        auto observer = tuned_observer{};
+        auto serving = std::thread{[&] {
+            CHECK(server.serve(*listener, observer));
+        }};
+        auto const client = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        REQUIRE(::connect(client, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) == 0);
+        for(auto i = 0; i != 1000 && !observer.connected; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        REQUIRE(observer.connected);
+        // Nagle's algorithm is on by default, kernel doubles buffer sizes
+        CHECK(observer.no_delay == 1);
+        CHECK(observer.receive_buffer == 2 * options.receive_buffer);
+        CHECK(observer.send_buffer == 2 * options.send_buffer);
+        CHECK(observer.not_sent_low_watermark == options.not_sent_low_watermark);
+        CHECK(observer.receive_low_watermark == options.receive_low_watermark);
+        ::close(client);
+        server.stop();
+        serving.join();
+    }
+
 }
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "doctest.h"
+
+#include <sys/uio.h>
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <inter/tcp_connection.hpp>
+
+
+namespace {
+
+    constexpr auto idle_connections = 200;
+
+
+    // Passes 'bytes' through receive buffer borrowed by 'connection',
+    // returns false if they come out changed
+    bool receive(inter::tcp_connections& connections,
+                 inter::tcp_connection& connection,
+                 std::string_view bytes,
+                 bool consumed = true) {
+        connections.borrow_rx(connection);
+        auto const space = connection.rx.prepare(bytes.size(), 1024 * 1024);
+        if(space.size() < bytes.size())
+            return false;
+        std::memcpy(space.data(), bytes.data(), bytes.size());
+        connection.rx.commit(bytes.size());
+        auto const received = connection.rx.data();
+        auto const same = std::string_view{received.data(), received.size()} == bytes;
+        if(consumed)
+            connection.rx.consume(received.size());
+        connections.return_rx(connection);
+        return same;
+    }
+
+
+    // Bytes gathered from output of 'connection'
+    std::string gathered(inter::tcp_connection const& connection) {
+        auto iovecs = std::array<iovec, 16>{};
+        auto const count = connection.tx.gather(iovecs);
+        auto bytes = std::string{};
+        for(auto i = std::size_t{0}; i != count; ++i)
+            bytes.append(static_cast<char const*>(iovecs[i].iov_base), iovecs[i].iov_len);
+        return bytes;
+    }
+
+
+    // Queues 'bytes' to output borrowed by 'connection' and sends 'sent'
+    // of them, returns false if queued ones are not the ones gathered
+    bool transmit(inter::tcp_connections& connections,
+                  inter::tcp_connection& connection,
+                  std::string_view bytes,
+                  std::size_t sent,
+                  bool in_flight = false) {
+        connections.borrow_tx(connection);
+        connections.borrow_iovecs(connection);
+        connection.tx.copy(std::span<char const>{bytes});
+        connection.tx_iovecs.resize(inter::tcp_output::gather_limit);
+        auto const same = gathered(connection) == bytes;
+        connection.tx.consume(sent);
+        connection.tx_in_flight = in_flight;
+        connections.return_tx(connection);
+        return same;
+    }
+
+} // namespace
+
+
+TEST_SUITE("tcp_connection") {
+
+    SCENARIO("idle connections share spare buffers") {
+        auto connections = inter::tcp_connections{};
+        connections.release_idle_buffers(true);
+        for(auto socket = 0; socket != idle_connections; ++socket)
+            connections.open(socket, sockaddr_in{});
+        auto rx_buffers = std::set<char const*>{};
+        auto tx_iovecs = std::set<iovec const*>{};
+        for(auto round = 0; round != 3; ++round)
+            for(auto socket = 0; socket != idle_connections; ++socket) {
+                CAPTURE(socket);
+                auto& connection = *connections.find(socket);
+                auto const message = "message " + std::to_string(round * 1000 + socket);
+                REQUIRE(receive(connections, connection, message));
+                CHECK(connection.rx.capacity() == 0u);
+                connections.borrow_rx(connection);
+                // The buffer returned last, cleared of its bytes
+                CHECK(connection.rx.capacity() != 0u);
+                CHECK(connection.rx.empty());
+                rx_buffers.insert(connection.rx.data().data());
+                connections.return_rx(connection);
+                REQUIRE(transmit(connections, connection, message, message.size()));
+                CHECK_FALSE(connection.tx.allocated());
+                CHECK(connection.tx_iovecs.capacity() == 0u);
+                connections.borrow_tx(connection);
+                connections.borrow_iovecs(connection);
+                CHECK(connection.tx.allocated());
+                CHECK(connection.tx.empty());
+                tx_iovecs.insert(connection.tx_iovecs.data());
+                connections.return_tx(connection);
+            }
+        // One buffer of each kind served all the connections in turn
+        CHECK(rx_buffers.size() == 1u);
+        CHECK(tx_iovecs.size() == 1u);
+    }
+
+
+    SCENARIO("connection keeps buffers holding its bytes") {
+        auto connections = inter::tcp_connections{};
+        connections.release_idle_buffers(true);
+        for(auto socket = 0; socket != idle_connections; ++socket)
+            connections.open(socket, sockaddr_in{});
+        auto& unconsumed = *connections.find(0);
+        auto& queued = *connections.find(1);
+        auto& in_flight = *connections.find(2);
+        REQUIRE(receive(connections, unconsumed, "partial request", false));
+        REQUIRE(transmit(connections, queued, "queued response", 7));
+        REQUIRE(transmit(connections, in_flight, "sent response", 13, true));
+        auto const* const kept = in_flight.tx_iovecs.data();
+        // The rest go idle many times meanwhile
+        for(auto round = 0; round != 3; ++round)
+            for(auto socket = 3; socket != idle_connections; ++socket) {
+                auto& connection = *connections.find(socket);
+                auto const message = "message " + std::to_string(socket);
+                REQUIRE(receive(connections, connection, message));
+                REQUIRE(transmit(connections, connection, message, message.size()));
+            }
+        auto const rx = unconsumed.rx.data();
+        CHECK(std::string_view{rx.data(), rx.size()} == "partial request");
+        CHECK(gathered(queued) == "response");
+        CHECK(in_flight.tx.allocated());
+        CHECK(in_flight.tx_iovecs.data() == kept);
+        // Buffers are returned once drained
+        unconsumed.rx.consume(rx.size());
+        connections.return_rx(unconsumed);
+        CHECK(unconsumed.rx.capacity() == 0u);
+        queued.tx.consume(queued.tx.size());
+        connections.return_tx(queued);
+        CHECK_FALSE(queued.tx.allocated());
+        in_flight.tx_in_flight = false;
+        connections.return_tx(in_flight);
+        CHECK_FALSE(in_flight.tx.allocated());
+        CHECK(in_flight.tx_iovecs.capacity() == 0u);
+        // Closed connection returns what it holds
+        REQUIRE(receive(connections, *connections.find(3), "closed early", false));
+        connections.close(3);
+        auto& reopened = connections.open(3, sockaddr_in{});
+        CHECK(reopened.rx.capacity() == 0u);
+        connections.borrow_rx(reopened);
+        CHECK(reopened.rx.empty());
+        REQUIRE(receive(connections, reopened, "next connection"));
+    }
+
+}
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "doctest.h"
+
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <inter/tcp_output.hpp>
+
+
+namespace {
+
+    std::string_view view_of(iovec const& v) noexcept {
+        return {static_cast<char const*>(v.iov_base), v.iov_len};
+    }
+
+
+    // Temporary file removed with the last reference
+    inter::tcp_file_ptr temporary_file(std::string_view content) {
+        char path[] = "/tmp/inter-output-XXXXXX";
+        auto const descriptor = ::mkstemp(path);
+        REQUIRE(descriptor != -1);
+        REQUIRE(::write(descriptor, content.data(), content.size()) == ssize_t(content.size()));
+        ::close(descriptor);
+        auto file = inter::tcp_file::open(path);
+        ::unlink(path);
+        REQUIRE(file);
+        return *file;
+    }
+
+
+    std::string read_all(int socket, std::size_t size) {
+        auto received = std::string{};
+        char buffer[4096];
+        while(received.size() < size) {
+            auto const count = ::read(socket, buffer, sizeof(buffer));
+            if(count <= 0)
+                break;
+            received.append(buffer, std::size_t(count));
+        }
+        return received;
+    }
+
+
+    // Connected TCP sockets over loopback, the first one is non-blocking
+    bool loopback_pair(int (&sockets)[2]) {
+        auto const listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        auto address = sockaddr_in{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        auto length = socklen_t{sizeof(address)};
+        auto* const generic = reinterpret_cast<sockaddr*>(&address);
+        sockets[0] = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        sockets[1] = -1;
+        if(::bind(listener, generic, sizeof(address)) == 0
+           && ::listen(listener, 1) == 0
+           && ::getsockname(listener, generic, &length) == 0
+           && (::connect(sockets[0], generic, sizeof(address)) == 0 || errno == EINPROGRESS))
+            sockets[1] = ::accept(listener, nullptr, nullptr);
+        ::close(listener);
+        return sockets[1] != -1;
+    }
+
+
+    bool sigpipe_pending() {
+        auto pending = sigset_t{};
+        ::sigpending(&pending);
+        return ::sigismember(&pending, SIGPIPE) == 1;
+    }
+
+
+    bool sigpipe_blocked() {
+        auto mask = sigset_t{};
+        ::pthread_sigmask(SIG_BLOCK, nullptr, &mask);
+        return ::sigismember(&mask, SIGPIPE) == 1;
+    }
+
+} // namespace
+
+
+TEST_SUITE("tcp_output") {
+
+    SCENARIO("segments are gathered up to the next file range") {
+        static constexpr auto borrowed = std::string_view{"borrowed"};
+        auto output = inter::tcp_output{};
+        CHECK_FALSE(output.allocated());
+        output.append(std::string{"owned"});
+        output.borrow(borrowed);
+        output.share(std::make_shared<std::string const>("shared"));
+        output.append(inter::tcp_file_range{temporary_file("file"), 0, 4});
+        output.append(std::string{"tail"});
+        CHECK(output.size() == 5u + 8u + 6u + 4u + 4u);
+        CHECK(output.segments_count() == 5u);
+
+        auto iovecs = std::array<iovec, 8>{};
+        REQUIRE(output.gather(iovecs) == 3u);
+        CHECK(view_of(iovecs[0]) == "owned");
+        CHECK(view_of(iovecs[1]).data() == borrowed.data());
+        CHECK(view_of(iovecs[2]) == "shared");
+        // Gathering stops at the limit of vectors too
+        CHECK(output.gather(std::span{iovecs}.first(2)) == 2u);
+
+        // Partly sent segment is gathered from the first unsent byte
+        output.consume(7);
+        REQUIRE(output.gather(iovecs) == 2u);
+        CHECK(view_of(iovecs[0]) == "rrowed");
+        output.consume(6 + 6);
+        CHECK(output.gather(iovecs) == 0u);
+        REQUIRE(output.front_file() != nullptr);
+        output.consume(4);
+        REQUIRE(output.gather(iovecs) == 1u);
+        CHECK(view_of(iovecs[0]) == "tail");
+        output.consume(4);
+        CHECK(output.empty());
+        CHECK(output.allocated());
+    }
+
+    SCENARIO("copied bytes are coalesced without moving gathered ones") {
+        auto output = inter::tcp_output{};
+        output.copy(std::string_view{"head"});
+        auto iovecs = std::array<iovec, 4>{};
+        REQUIRE(output.gather(iovecs) == 1u);
+        auto const* const gathered = static_cast<char const*>(iovecs[0].iov_base);
+        for(auto i = 0; i != 100; ++i)
+            output.copy(std::string_view{"0123456789"});
+        CHECK(output.segments_count() == 1u);
+        REQUIRE(output.gather(iovecs) == 1u);
+        CHECK(iovecs[0].iov_base == gathered);
+        CHECK(iovecs[0].iov_len == 4u + 1000u);
+        // Bytes past the block go to the next segment
+        output.copy(std::string(inter::tcp_output::copy_block_size, 'x'));
+        CHECK(output.segments_count() == 2u);
+        REQUIRE(output.gather(iovecs) == 2u);
+        CHECK(iovecs[0].iov_base == gathered);
+    }
+
+    SCENARIO("appended output keeps its unsent bytes") {
+        auto output = inter::tcp_output{};
+        output.append(std::string{"first "});
+        auto other = inter::tcp_output{};
+        other.append(std::string{"xxsecond "});
+        other.append(inter::tcp_file_range{temporary_file("yythird "), 0, 8});
+        other.consume(2);
+        output.append(std::move(other));
+        CHECK(other.empty());
+        CHECK(output.size() == 6u + 7u + 8u);
+
+        auto third = inter::tcp_output{};
+        third.append(inter::tcp_file_range{temporary_file("zzfourth"), 0, 8});
+        third.consume(2);
+        output.append(std::move(third));
+
+        auto copied = std::string{};
+        auto const taken = output.copy_to([&](std::span<char const> bytes) {
+            copied.append(bytes.data(), bytes.size());
+            return bytes.size();
+        });
+        REQUIRE(taken);
+        CHECK(*taken == copied.size());
+        CHECK(copied == "first second yythird fourth");
+        CHECK(output.empty());
+    }
+
+    SCENARIO("sink taking fewer bytes stops copying") {
+        auto output = inter::tcp_output{};
+        output.append(std::string{"abcdef"});
+        output.append(std::string{"ghij"});
+        auto copied = std::string{};
+        auto const sink = [&](std::span<char const> bytes) {
+            auto const count = std::min(bytes.size(), std::size_t{4});
+            copied.append(bytes.data(), count);
+            return count;
+        };
+        auto const taken = output.copy_to(sink);
+        REQUIRE(taken);
+        CHECK(*taken == 4u);
+        CHECK(copied == "abcd");
+        CHECK(output.size() == 6u);
+        REQUIRE(output.copy_to(sink));
+        REQUIRE(output.copy_to(sink));
+        CHECK(copied == "abcdefghij");
+        CHECK(output.empty());
+    }
+
+    SCENARIO("bytes and file ranges are written to socket in order") {
+        int sockets[2];
+        REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+        auto output = inter::tcp_output{};
+        output.append(std::string{"head "});
+        output.append(inter::tcp_file_range{temporary_file("..file body.."), 2, 9});
+        output.borrow(std::string_view{" tail"});
+        auto const expected = std::string_view{"head file body tail"};
+        auto const written = output.write_to(sockets[0]);
+        REQUIRE(written);
+        CHECK(*written == expected.size());
+        CHECK(output.empty());
+        CHECK(read_all(sockets[1], expected.size()) == expected);
+        ::close(sockets[0]);
+        ::close(sockets[1]);
+    }
+
+    SCENARIO("segments are written through iovecs given by caller") {
+        int sockets[2];
+        REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+        auto output = inter::tcp_output{};
+        auto expected = std::string{};
+        for(auto i = 0; i != 9; ++i) {
+            expected += std::to_string(i);
+            output.append(std::to_string(i));
+        }
+        output.append(inter::tcp_file_range{temporary_file("file"), 0, 4});
+        output.borrow(std::string_view{"tail"});
+        expected += "filetail";
+        // Fewer iovecs than segments take several writes
+        auto iovecs = std::array<iovec, 2>{};
+        auto const written = output.write_to(sockets[0], iovecs);
+        REQUIRE(written);
+        CHECK(*written == expected.size());
+        CHECK(output.empty());
+        CHECK(read_all(sockets[1], expected.size()) == expected);
+        ::close(sockets[0]);
+        ::close(sockets[1]);
+    }
+
+    SCENARIO("full socket takes part of output, the rest waits for it to drain") {
+        int sockets[2];
+        REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets) == 0);
+        auto const buffer_size = 4096;
+        ::setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+        auto expected = std::string{};
+        for(auto i = 0; expected.size() < 1024 * 1024; ++i)
+            expected += std::to_string(i) + ' ';
+        auto output = inter::tcp_output{};
+        output.borrow(expected);
+        auto const first = output.write_to(sockets[0]);
+        REQUIRE(first);
+        CHECK(*first < expected.size());
+        CHECK(output.size() == expected.size() - *first);
+        auto const again = output.write_to(sockets[0]);
+        REQUIRE(again);
+        CHECK(*again == 0u);
+        auto received = std::string{};
+        char chunk[8192];
+        while(received.size() != expected.size()) {
+            auto const count = ::read(sockets[1], chunk, sizeof(chunk));
+            if(count > 0)
+                received.append(chunk, std::size_t(count));
+            REQUIRE(output.write_to(sockets[0]));
+            if(count <= 0 && output.empty())
+                break;
+        }
+        CHECK(output.empty());
+        CHECK(received == expected);
+        ::close(sockets[0]);
+        ::close(sockets[1]);
+    }
+
+
+    SCENARIO("file range is sent to full TCP socket in parts") {
+        int sockets[2];
+        REQUIRE(loopback_pair(sockets));
+        auto const buffer_size = 4096;
+        ::setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+        ::setsockopt(sockets[1], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        auto content = std::string{};
+        for(auto i = 0; content.size() < 4 * 1024 * 1024; ++i)
+            content += std::to_string(i) + ' ';
+        auto output = inter::tcp_output{};
+        output.append(std::string{"head "});
+        output.append(inter::tcp_file_range{temporary_file(content), 0, content.size()});
+        output.borrow(std::string_view{" tail"});
+        auto const expected = "head " + content + " tail";
+        // Client reads nothing yet
+        auto const first = output.write_to(sockets[0]);
+        REQUIRE(first);
+        CHECK(*first > 5u);
+        CHECK(*first < expected.size());
+        CHECK(output.front_file() != nullptr);
+        auto const again = output.write_to(sockets[0]);
+        REQUIRE(again);
+        CHECK(*again == 0u);
+        auto received = std::string{};
+        auto sends = 2;
+        char chunk[65536];
+        while(received.size() != expected.size()) {
+            auto const count = ::read(sockets[1], chunk, sizeof(chunk));
+            REQUIRE(count > 0);
+            received.append(chunk, std::size_t(count));
+            REQUIRE(output.write_to(sockets[0]));
+            ++sends;
+        }
+        CHECK(output.empty());
+        CHECK(sends > 4);
+        CHECK(received == expected);
+        CHECK_FALSE(sigpipe_blocked());
+        ::close(sockets[0]);
+        ::close(sockets[1]);
+    }
+
+
+    SCENARIO("file range sent to broken connection raises no SIGPIPE") {
+        auto const content = std::string(1024 * 1024, 'x');
+        auto const file = temporary_file(content);
+        // Alone and under the guard reactor holds while serving
+        for(auto const reactor: {false, true}) {
+            CAPTURE(reactor);
+            int sockets[2];
+            REQUIRE(loopback_pair(sockets));
+            ::close(sockets[1]);
+            auto result = std::expected<std::size_t, std::error_code>{};
+            {
+                auto const serving = reactor
+                    ? std::make_optional<inter::detail::sigpipe_guard>()
+                    : std::nullopt;
+                for(auto i = 0; i != 100 && result; ++i) {
+                    auto output = inter::tcp_output{};
+                    output.append(inter::tcp_file_range{file, 0, content.size()});
+                    result = output.write_to(sockets[0]);
+                }
+                CHECK(sigpipe_blocked() == reactor);
+            }
+            REQUIRE_FALSE(result);
+            CHECK((result.error().value() == EPIPE || result.error().value() == ECONNRESET));
+            CHECK_FALSE(sigpipe_blocked());
+            CHECK_FALSE(sigpipe_pending());
+            ::close(sockets[0]);
+        }
+    }
+
+}
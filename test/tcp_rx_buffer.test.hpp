@@ -0,0 +1,109 @@
+#pragma once
+
+#include "doctest.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+
+#include <inter/tcp_rx_buffer.hpp>
+
+
+namespace {
+
+    // Passes 'count' numbered bytes through the buffer in chunks, some of
+    // them are left unconsumed every time. Returns false if they come out
+    // of order
+    bool pass_bytes(inter::tcp_rx_buffer& buffer, std::size_t count, std::size_t limit) {
+        auto written = std::size_t{0};
+        auto read = std::size_t{0};
+        while(read != count) {
+            auto const space = buffer.prepare(1000, limit);
+            auto const chunk = std::min({space.size(), count - written, std::size_t{1000}});
+            for(auto i = std::size_t{0}; i != chunk; ++i)
+                space[i] = char(written + i);
+            buffer.commit(chunk);
+            written += chunk;
+            auto const bytes = buffer.data();
+            if(bytes.size() != written - read)
+                return false;
+            for(auto i = std::size_t{0}; i != bytes.size(); ++i)
+                if(bytes[i] != char(read + i))
+                    return false;
+            auto const kept = written == count ? 0u : std::min(bytes.size(), std::size_t{700});
+            buffer.consume(bytes.size() - kept);
+            read += bytes.size() - kept;
+        }
+        return true;
+    }
+
+
+    // Lowest descriptor number not in use, no new descriptor can be
+    // created while the limit is held there
+    struct descriptors_exhausted {
+        rlimit saved{};
+
+        descriptors_exhausted() {
+            ::getrlimit(RLIMIT_NOFILE, &saved);
+            auto const lowest = ::dup(0);
+            ::close(lowest);
+            auto limit = saved;
+            limit.rlim_cur = rlim_t(lowest);
+            ::setrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        ~descriptors_exhausted() {
+            ::setrlimit(RLIMIT_NOFILE, &saved);
+        }
+    }; // descriptors_exhausted
+
+} // namespace
+
+
+TEST_SUITE("tcp_rx_buffer") {
+
+    SCENARIO("bytes wrap around the mirrored ring in order") {
+        auto buffer = inter::tcp_rx_buffer{};
+        CHECK(pass_bytes(buffer, 100000, 8192));
+        CHECK(buffer.mirrored());
+        CHECK(buffer.capacity() <= 8192);
+        CHECK(buffer.empty());
+    }
+
+    SCENARIO("buffer keeps bytes in plain memory if ring can not be mapped") {
+        auto buffer = inter::tcp_rx_buffer{};
+        auto const unmapped = inter::tcp_rx_buffer::unmapped_rings();
+        {
+            auto const exhausted = descriptors_exhausted{};
+            auto const space = buffer.prepare(100, 8192);
+            REQUIRE(space.size() >= 100);
+        }
+        CHECK_FALSE(buffer.mirrored());
+        CHECK(inter::tcp_rx_buffer::unmapped_rings() == unmapped + 1);
+        CHECK(pass_bytes(buffer, 100000, 8192));
+        CHECK(buffer.capacity() <= 8192);
+        CHECK(buffer.empty());
+    }
+
+    SCENARIO("buffer not asked for ring takes plain memory") {
+        auto buffer = inter::tcp_rx_buffer{};
+        auto const unmapped = inter::tcp_rx_buffer::unmapped_rings();
+        REQUIRE(buffer.prepare(100, 8192, false).size() >= 100);
+        CHECK_FALSE(buffer.mirrored());
+        CHECK(inter::tcp_rx_buffer::unmapped_rings() == unmapped);
+    }
+
+    SCENARIO("full buffer gives no space") {
+        auto const limit = inter::detail::mirrored_region::page_size();
+        auto buffer = inter::tcp_rx_buffer{};
+        auto const space = buffer.prepare(limit, limit);
+        REQUIRE(space.size() == limit);
+        buffer.commit(space.size());
+        CHECK(buffer.prepare(1, limit).empty());
+        buffer.consume(1);
+        CHECK(buffer.prepare(1, limit).size() == 1);
+    }
+
+}
@@ -3,3 +3,11 @@
 
 
 #include "sockets.test.hpp"
+#include "http_request.test.hpp"
+#include "tcp_rx_buffer.test.hpp"
+#include "shm_channel.test.hpp"
+#include "http_server.test.hpp"
+#include "timer_wheel.test.hpp"
+#include "bounded_queue.test.hpp"
+#include "tcp_output.test.hpp"
+#include "tcp_connection.test.hpp"
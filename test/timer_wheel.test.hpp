@@ -0,0 +1,135 @@
+#pragma once
+
+#include "doctest.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <inter/timer_wheel.hpp>
+
+
+namespace {
+
+    using namespace std::chrono_literals;
+
+    // Wheel of 1 ms ticks, advanced by the test
+    struct manual_wheel {
+        inter::timer_wheel::clock::time_point origin{inter::timer_wheel::clock::now()};
+        inter::timer_wheel wheel{1ms, origin};
+        std::int64_t now{0};
+
+        template<typename F> void advance_to(std::int64_t ms, F&& expired) {
+            now = ms;
+            wheel.advance(origin + std::chrono::milliseconds{ms}, expired);
+        }
+    }; // manual_wheel
+
+} // namespace
+
+
+TEST_SUITE("timer_wheel") {
+
+    SCENARIO("timers expire at their ticks on every level") {
+        constexpr std::int64_t timeouts[] = {
+            1, 5, 63, 64, 65, 200, 4095, 4096, 4097, 5000, 262143, 262144, 300000
+        };
+        auto m = manual_wheel{};
+        auto nodes = std::vector<inter::timer_node>(std::size(timeouts));
+        for(auto i = std::size_t{0}; i != nodes.size(); ++i) {
+            nodes[i].tag = i;
+            m.wheel.arm(nodes[i], std::chrono::milliseconds{timeouts[i]});
+        }
+        CHECK(m.wheel.size() == nodes.size());
+        auto fired = std::vector<std::int64_t>(nodes.size(), -1);
+        for(auto ms = std::int64_t{1}; ms <= 300000; ++ms)
+            m.advance_to(ms, [&](inter::timer_node& node) {
+                fired[node.tag] = m.now;
+            });
+        for(auto i = std::size_t{0}; i != nodes.size(); ++i) {
+            CAPTURE(timeouts[i]);
+            CHECK(fired[i] == timeouts[i]);
+            CHECK_FALSE(nodes[i].armed());
+        }
+        CHECK(m.wheel.empty());
+        CHECK_FALSE(m.wheel.next_timeout());
+    }
+
+    SCENARIO("timeout is rounded up to resolution") {
+        auto const origin = inter::timer_wheel::clock::now();
+        auto wheel = inter::timer_wheel{10ms, origin};
+        auto node = inter::timer_node{};
+        wheel.arm(node, 15ms);
+        auto fired = 0;
+        auto const count = [&](inter::timer_node&) { ++fired; };
+        wheel.advance(origin + 19ms, count);
+        CHECK(fired == 0);
+        wheel.advance(origin + 20ms, count);
+        CHECK(fired == 1);
+        // Zero timeout expires on the next tick
+        wheel.arm(node, 0ms);
+        wheel.advance(origin + 30ms, count);
+        CHECK(fired == 2);
+    }
+
+    SCENARIO("expiry callback cancels and re-arms timers") {
+        auto m = manual_wheel{};
+        inter::timer_node nodes[3];
+        for(auto i = 0; i != 3; ++i) {
+            nodes[i].tag = std::uintptr_t(i);
+            m.wheel.arm(nodes[i], 10ms);
+        }
+        auto fired = std::vector<std::uintptr_t>{};
+        auto const expired = [&](inter::timer_node& node) {
+            fired.push_back(node.tag);
+            // The first one to expire cancels the rest of the slot but
+            // timer 0, which is armed again
+            for(auto& other: nodes)
+                if(&other != &node)
+                    m.wheel.cancel(other);
+            if(node.tag != 0u)
+                m.wheel.arm(nodes[0], 5ms);
+        };
+        m.advance_to(10, expired);
+        REQUIRE(fired.size() == 1u);
+        CHECK(fired[0] != 0u);
+        CHECK(m.wheel.size() == 1u);
+        CHECK(nodes[0].armed());
+        m.advance_to(15, expired);
+        CHECK(fired.size() == 2u);
+        CHECK(fired[1] == 0u);
+        CHECK(m.wheel.empty());
+    }
+
+    SCENARIO("next timeout never passes the nearest expiry") {
+        auto m = manual_wheel{};
+        auto node = inter::timer_node{};
+        m.wheel.arm(node, 5000ms);
+        auto fired = false;
+        auto waits = 0;
+        // Loop waits as told, upper levels are reached in a few waits
+        while(!fired) {
+            auto const next = m.wheel.next_timeout();
+            REQUIRE(next);
+            CHECK(next->count() > 0);
+            CHECK(m.now + next->count() <= 5000);
+            m.advance_to(m.now + next->count(), [&](inter::timer_node&) { fired = true; });
+            ++waits;
+        }
+        CHECK(m.now == 5000);
+        CHECK(waits <= 4);
+    }
+
+    SCENARIO("too long timeout is clamped to the wheel span") {
+        auto m = manual_wheel{};
+        auto node = inter::timer_node{};
+        m.wheel.arm(node, std::chrono::hours{24 * 365});
+        auto const next = m.wheel.next_timeout();
+        REQUIRE(next);
+        CHECK(next->count() <= (std::int64_t{1} << 24));
+        m.wheel.cancel(node);
+        CHECK(m.wheel.empty());
+        CHECK_FALSE(node.armed());
+    }
+
+}